@@ -9,15 +9,16 @@
     Extensions:
         GL_ARB_debug_output,
         GL_ARB_texture_filter_anisotropic,
-        GL_EXT_texture_compression_s3tc
+        GL_EXT_texture_compression_s3tc,
+        GL_ARB_get_program_binary
     Loader: True
     Local files: True
     Omit khrplatform: False
 
     Commandline:
-        --profile="compatibility" --api="gl=3.3" --generator="c" --spec="gl" --local-files --extensions="GL_ARB_debug_output,GL_ARB_texture_filter_anisotropic,GL_EXT_texture_compression_s3tc"
+        --profile="compatibility" --api="gl=3.3" --generator="c" --spec="gl" --local-files --extensions="GL_ARB_debug_output,GL_ARB_texture_filter_anisotropic,GL_EXT_texture_compression_s3tc,GL_ARB_get_program_binary,GL_KHR_parallel_shader_compile,GL_ARB_parallel_shader_compile,GL_ARB_buffer_storage"
     Online:
-        http://glad.dav1d.de/#profile=compatibility&language=c&specification=gl&loader=on&api=gl%3D3.3&extensions=GL_ARB_debug_output&extensions=GL_ARB_texture_filter_anisotropic&extensions=GL_EXT_texture_compression_s3tc
+        http://glad.dav1d.de/#profile=compatibility&language=c&specification=gl&loader=on&api=gl%3D3.3&extensions=GL_ARB_debug_output&extensions=GL_ARB_texture_filter_anisotropic&extensions=GL_EXT_texture_compression_s3tc&extensions=GL_ARB_get_program_binary&extensions=GL_KHR_parallel_shader_compile&extensions=GL_ARB_parallel_shader_compile&extensions=GL_ARB_buffer_storage
 */
 
 #include <stdio.h>
@@ -974,6 +975,16 @@ PFNGLFRONTFACEPROC glad_glFrontFace;
 PFNGLGETBOOLEANI_VPROC glad_glGetBooleani_v;
 PFNGLCLEARBUFFERUIVPROC glad_glClearBufferuiv;
 int GLAD_GL_EXT_texture_compression_s3tc;
+int GLAD_GL_ARB_get_program_binary;
+PFNGLGETPROGRAMBINARYPROC glad_glGetProgramBinary;
+PFNGLPROGRAMBINARYPROC glad_glProgramBinary;
+PFNGLPROGRAMPARAMETERIPROC glad_glProgramParameteri;
+int GLAD_GL_KHR_parallel_shader_compile;
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glad_glMaxShaderCompilerThreadsKHR;
+int GLAD_GL_ARB_parallel_shader_compile;
+PFNGLMAXSHADERCOMPILERTHREADSARBPROC glad_glMaxShaderCompilerThreadsARB;
+int GLAD_GL_ARB_buffer_storage;
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage;
 int GLAD_GL_ARB_debug_output;
 int GLAD_GL_ARB_texture_filter_anisotropic;
 PFNGLDEBUGMESSAGECONTROLARBPROC glad_glDebugMessageControlARB;
@@ -1750,11 +1761,33 @@ static void load_GL_ARB_debug_output(GLADloadproc load) {
 	glad_glDebugMessageCallbackARB = (PFNGLDEBUGMESSAGECALLBACKARBPROC)load("glDebugMessageCallbackARB");
 	glad_glGetDebugMessageLogARB = (PFNGLGETDEBUGMESSAGELOGARBPROC)load("glGetDebugMessageLogARB");
 }
+static void load_GL_ARB_get_program_binary(GLADloadproc load) {
+	if(!GLAD_GL_ARB_get_program_binary) return;
+	glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+	glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+	glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+}
+static void load_GL_KHR_parallel_shader_compile(GLADloadproc load) {
+	if(!GLAD_GL_KHR_parallel_shader_compile) return;
+	glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+}
+static void load_GL_ARB_parallel_shader_compile(GLADloadproc load) {
+	if(!GLAD_GL_ARB_parallel_shader_compile) return;
+	glad_glMaxShaderCompilerThreadsARB = (PFNGLMAXSHADERCOMPILERTHREADSARBPROC)load("glMaxShaderCompilerThreadsARB");
+}
+static void load_GL_ARB_buffer_storage(GLADloadproc load) {
+	if(!GLAD_GL_ARB_buffer_storage) return;
+	glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+}
 static int find_extensionsGL(void) {
 	if (!get_exts()) return 0;
 	GLAD_GL_ARB_debug_output = has_ext("GL_ARB_debug_output");
 	GLAD_GL_ARB_texture_filter_anisotropic = has_ext("GL_ARB_texture_filter_anisotropic");
 	GLAD_GL_EXT_texture_compression_s3tc = has_ext("GL_EXT_texture_compression_s3tc");
+	GLAD_GL_ARB_get_program_binary = has_ext("GL_ARB_get_program_binary");
+	GLAD_GL_KHR_parallel_shader_compile = has_ext("GL_KHR_parallel_shader_compile");
+	GLAD_GL_ARB_parallel_shader_compile = has_ext("GL_ARB_parallel_shader_compile");
+	GLAD_GL_ARB_buffer_storage = has_ext("GL_ARB_buffer_storage");
 	free_exts();
 	return 1;
 }
@@ -1834,6 +1867,10 @@ int gladLoadGLLoader(GLADloadproc load) {
 
 	if (!find_extensionsGL()) return 0;
 	load_GL_ARB_debug_output(load);
+	load_GL_ARB_get_program_binary(load);
+	load_GL_KHR_parallel_shader_compile(load);
+	load_GL_ARB_parallel_shader_compile(load);
+	load_GL_ARB_buffer_storage(load);
 	return GLVersion.major != 0 || GLVersion.minor != 0;
 }
 
@@ -11,8 +11,6 @@ in		vec4	vs_col;
 $include "normal_mapping.glsl"
 $include "skybox.glsl"
 
-uniform mat4	cam_to_world;
-
 uniform sampler2D	albedo;
 uniform sampler2D	normal;
 uniform sampler2D	metallic;
@@ -20,7 +18,7 @@ uniform sampler2D	roughness;
 
 void main () {
 	vec4 alb = texture(albedo, vs_uv).rgba;
-	vec3 norm_cam = normal_mapping(vs_pos_cam, vs_norm_cam, vs_tang_cam, vs_uv, normal);
+	vec3 norm_cam = normal_mapping(vs_pos_cam, vs_norm_cam, vs_tang_cam, texture(normal, vs_uv).rgb);
 	
 	vec3 cam_to_p = normalize(vs_pos_cam);
 	vec3 refl_cam = reflect(cam_to_p,
@@ -1,15 +1,21 @@
-
+#pragma once
 out		vec4	frag_col;
 
-uniform	vec2	mcursor_pos;
-uniform	vec2	screen_dim;
-
-bool dbg_out_written = false;
-vec4 dbg_out = vec4(1,0,1,1); // complains about maybe used uninitialized
+$include "ubo.glsl"
 
 vec2 mouse () {		return mcursor_pos / screen_dim; }
 vec2 screen () {	return gl_FragCoord.xy / screen_dim; }
 
+// DEBUG is set for the debug variants (Shader::get_draw_variant with shader_debug on)
+//  without it the debug hooks compile to nothing, so production fragments dont pay for the split line blending
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+#if DEBUG
+bool dbg_out_written = false;
+vec4 dbg_out = vec4(1,0,1,1); // complains about maybe used uninitialized
+
 bool split_horizon = false;
 bool split_vertial = false;
 
@@ -52,5 +58,22 @@ void FRAG_COL (vec4 col) {
 void FRAG_COL (vec3 col) {
 	FRAG_COL(vec4(col, 1));
 }
+#else
+#define SPLIT_LEFT		false
+#define SPLIT_TOP		false
+#define SPLIT_RIGHT		false
+#define SPLIT_BOTTOM	false
+
+void DBG_COL (vec4 col) {}
+void DBG_COL (vec3 col) {}
+void DBG_COL (vec2 col) {}
+
+void FRAG_COL (vec4 col) {
+	frag_col = col;
+}
+void FRAG_COL (vec3 col) {
+	FRAG_COL(vec4(col, 1));
+}
+#endif
 
 float map (float x, float a, float b) { return (x -a) / (b -a); }
@@ -0,0 +1,32 @@
+#version 150 core // version 3.2
+
+// depth only, ALPHA_TEST discards like nier.frag with the alpha of the albedo texture (texture unit 0)
+#ifndef ALPHA_TEST
+#define ALPHA_TEST 0
+#endif
+#ifndef TEX_ARRAYS
+#define TEX_ARRAYS 0
+#endif
+
+#if ALPHA_TEST
+in		vec2	vs_uv;
+
+#if TEX_ARRAYS
+uniform vec4			tex_layers;
+uniform sampler2DArray	albedo;
+#else
+uniform sampler2D		albedo;
+#endif
+#endif
+
+void main () {
+	#if ALPHA_TEST
+	#if TEX_ARRAYS
+	float alpha = texture(albedo, vec3(vs_uv, tex_layers[0])).a;
+	#else
+	float alpha = texture(albedo, vs_uv).a;
+	#endif
+	
+	if (alpha <= 254.0/255.0) discard;
+	#endif
+}
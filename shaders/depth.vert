@@ -0,0 +1,29 @@
+#version 150 core // version 3.2
+
+// position only version of mesh_vertex.vert for depth only passes, reads the depth_vert_layout (depth_uv_vert_layout for ALPHA_TEST) streams
+#ifndef ALPHA_TEST
+#define ALPHA_TEST 0
+#endif
+
+in		vec3	pos_model;
+
+#if ALPHA_TEST
+in		vec2	uv;
+
+out		vec2	vs_uv;
+#endif
+
+$include "ubo.glsl"
+
+invariant gl_Position; // the opaque pass has to end up with the exact same depth
+
+void main () {
+	vec3 pos_world =	(model_to_world * vec4(pos_model,1)).xyz;
+	vec3 pos_cam =		(world_to_cam * vec4(pos_world,1)).xyz;
+	
+	gl_Position =		cam_to_clip * vec4(pos_cam, 1);
+	
+	#if ALPHA_TEST
+	vs_uv =				uv;
+	#endif
+}
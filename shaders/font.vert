@@ -7,8 +7,7 @@ in		vec4	col;
 out		vec2	vs_uv;
 out		vec4	vs_col;
 
-uniform	vec2	mcursor_pos;
-uniform	vec2	screen_dim;
+$include "ubo.glsl"
 
 #define QUAD(a,b,c,d) b,c,a, a,c,d
 
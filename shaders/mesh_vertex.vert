@@ -6,17 +6,31 @@ in		vec4	tang_model;
 in		vec2	uv;
 in		vec4	col;
 
+#ifndef INSTANCED
+#define INSTANCED 0
+#endif
+
+#if INSTANCED
+in		mat4	instance_model_to_world;
+in		vec4	instance_col;
+#endif
+
 out		vec3	vs_pos_cam;
 out		vec3	vs_norm_cam;
 out		vec4	vs_tang_cam;
 out		vec2	vs_uv;
 out		vec4	vs_col;
 
-uniform	mat4	model_to_world;
-uniform	mat4	world_to_cam;
-uniform	mat4	cam_to_clip;
+$include "ubo.glsl"
+
+invariant gl_Position; // same depth as depth.vert, for the depth prepass
 
 void main () {
+#if INSTANCED
+	mat4 model_to_world =	instance_model_to_world;
+	vec4 model_col =		instance_col;
+#endif
+	
 	vec3 pos_world =	(model_to_world * vec4(pos_model,1)).xyz;
 	vec3 pos_cam =		(world_to_cam * vec4(pos_world,1)).xyz;
 	
@@ -35,5 +49,5 @@ void main () {
 	vs_norm_cam =		norm_cam;
 	vs_tang_cam =		tang_cam;
 	vs_uv =				uv;
-	vs_col =			col;
+	vs_col =			col * model_col;
 }
@@ -0,0 +1,79 @@
+#version 150 core // version 3.2
+
+// permutations (Shader defines): ALPHA_TEST for the opaque alpha tested pass, without it the transparent pass2
+//  TEX_ARRAYS if the textures are packed into texture arrays by pack_texture_arrays()
+#ifndef ALPHA_TEST
+#define ALPHA_TEST 0
+#endif
+#ifndef TEX_ARRAYS
+#define TEX_ARRAYS 0
+#endif
+
+$include "common.glsl"
+
+in		vec3	vs_pos_cam;
+in		vec3	vs_norm_cam;
+in		vec4	vs_tang_cam;
+in		vec2	vs_uv;
+in		vec4	vs_col;
+
+$include "normal_mapping.glsl"
+$include "skybox.glsl"
+
+#if TEX_ARRAYS
+// textures packed into texture arrays by pack_texture_arrays(), tex_layers holds the layer per texture unit
+uniform vec4		tex_layers;
+
+uniform sampler2DArray	albedo;
+uniform sampler2DArray	normal;
+uniform sampler2DArray	a;
+uniform sampler2DArray	b;
+
+#define TEX(tex, unit, uv)	texture(tex, vec3(uv, tex_layers[unit]))
+#else
+uniform sampler2D	albedo;
+uniform sampler2D	normal;
+uniform sampler2D	a;
+uniform sampler2D	b;
+
+#define TEX(tex, unit, uv)	texture(tex, uv)
+#endif
+
+void main () {
+	vec4 alb = TEX(albedo, 0, vs_uv).rgba;
+	
+	vec4 a_ = TEX(a, 2, vs_uv).rgba;
+	vec4 b_ = TEX(b, 3, vs_uv).bbba;
+	
+	//alb += vec4(a_.r, 0,0,1) * clamp(mouse().x, 0, 1);
+	//alb = vec4(b_.xyz, 1);
+	
+	#if ALPHA_TEST
+	if (alb.a <= 254.0/255.0) discard;
+	alb.a = 1;
+	#endif
+	
+	vec3 norm_cam = normal_mapping(vs_pos_cam, vs_norm_cam, vs_tang_cam, TEX(normal, 1, vs_uv).rgb);
+	
+	vec3 cam_to_p = normalize(vs_pos_cam);
+	vec3 refl_cam = reflect(cam_to_p,
+		//SPLIT_LEFT ? normalize(vs_norm_cam) :
+		norm_cam);
+	
+	vec4 col = vec4( sky(mat3(cam_to_world) * refl_cam), 1 );
+	
+	col *= alb * vs_col;
+	col = alb;
+	
+	//if (SPLIT_BOTTOM) {
+	//	if (SPLIT_LEFT) DBG_COL((mat3(cam_to_world) * norm_cam) * 0.5 +0.5);
+	//	else			DBG_COL((mat3(cam_to_world) * vs_norm_cam) * 0.5 +0.5);
+	//}
+	
+	//if (SPLIT_RIGHT) DBG_COL(pow(TEX(normal, 1, vs_uv).rgb, vec3(2.2)));
+	
+	//#if !ALPHA_TEST
+	//if (alb.a != 0) DBG_COL(vec3(1,0,0)); // show what the transparent pass draws
+	//#endif
+	FRAG_COL(col);
+}
@@ -1,5 +0,0 @@
-#version 150 core // version 3.2
-
-#define ALPHA_TEST 1
-#define SHOW_ALPHA_TEST_HACK
-$include "nier.glsl"
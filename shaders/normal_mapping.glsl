@@ -1,5 +1,5 @@
-
-vec3 normal_mapping (vec3 pos_cam, vec3 geom_norm_cam, vec4 tang_cam, vec2 uv, sampler2D normal_tex) {
+#pragma once
+vec3 normal_mapping (vec3 pos_cam, vec3 geom_norm_cam, vec4 tang_cam, vec3 normal_tang_sample) { // normal_tang_sample: normal map texel, normal in tangent space
 	
 	geom_norm_cam = normalize(geom_norm_cam);
 	
@@ -17,7 +17,6 @@ vec3 normal_mapping (vec3 pos_cam, vec3 geom_norm_cam, vec4 tang_cam, vec2 uv, s
 		TBN_tang_to_cam = mat3(t, b, n);
 	}
 	
-	vec3 normal_tang_sample = texture(normal_tex, uv).rgb; // normal in tangent space
 	vec3 norm_tang = normalize(normal_tang_sample * 2.0 -1.0);
 	vec3 norm_cam = TBN_tang_to_cam * norm_tang;
 	
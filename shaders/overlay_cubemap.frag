@@ -2,9 +2,18 @@
 
 $include "common.glsl"
 
+// SH_IRRADIANCE shows the diffuse lighting from the SH coefficients of a Prefiltered_Env instead of tex0
+
+#ifndef SH_IRRADIANCE
+#define SH_IRRADIANCE 0
+#endif
+
 in		vec2	vs_uv;
 
 uniform samplerCube	tex0;
+#if SH_IRRADIANCE
+uniform vec3		sh_irradiance[9];
+#endif
 
 #define PI 3.1415926535897932384626433832795
 
@@ -21,10 +30,31 @@ vec3 uv_to_cubemap_dir (vec2 uv) {
 		sin(uv.y * PI -PI/2) );
 }
 
+#if SH_IRRADIANCE
+// same basis as sh9_basis() in ibl_prefilter.hpp
+vec3 eval_sh9 (vec3 d) {
+	return	sh_irradiance[0] * 0.282095 +
+			
+			sh_irradiance[1] * 0.488603 * d.y +
+			sh_irradiance[2] * 0.488603 * d.z +
+			sh_irradiance[3] * 0.488603 * d.x +
+			
+			sh_irradiance[4] * 1.092548 * d.x * d.y +
+			sh_irradiance[5] * 1.092548 * d.y * d.z +
+			sh_irradiance[6] * 0.315392 * (3 * d.z * d.z -1) +
+			sh_irradiance[7] * 1.092548 * d.x * d.z +
+			sh_irradiance[8] * 0.546274 * (d.x * d.x -d.y * d.y);
+}
+#endif
+
 void main () {
 	vec3 dir = uv_to_cubemap_dir(vs_uv);
 	
 	//if (max(max(abs(dir.x), abs(dir.y)), abs(dir.z)) != +dir.z) DBG_COL(vec3(1,0,0));
+#if SH_IRRADIANCE
+	FRAG_COL( vec4(max(eval_sh9(dir), 0) / PI, 1) ); // lambert diffuse of a white surface facing dir
+#else
 	FRAG_COL( texture(tex0, dir).rgba );
+#endif
 	//FRAG_COL( (uv_to_cubemap_dir(vs_uv) / 2 +0.5).zzz );
 }
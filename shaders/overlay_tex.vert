@@ -2,8 +2,7 @@
 
 out		vec2	vs_uv;
 
-uniform	vec2	mcursor_pos;
-uniform	vec2	screen_dim;
+$include "ubo.glsl"
 
 uniform	vec2	pos_clip;
 uniform	vec2	size_clip;
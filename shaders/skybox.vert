@@ -2,11 +2,7 @@
 
 out		vec3	vs_pos_world_dir;
 
-uniform	mat4	world_to_clip;
-uniform	vec2	mcursor_pos;
-uniform	vec2	screen_dim;
-
-uniform	mat4	skybox_to_clip;
+$include "ubo.glsl"
 
 #define LLL	vec3(-1,-1,-1)
 #define HLL	vec3(+1,-1,-1)
@@ -0,0 +1,16 @@
+#pragma once
+// keep in sync with namespace ubo in gl.hpp, the offsets are checked when a shader is linked
+
+layout(std140) uniform View { // written once per frame
+	mat4	world_to_cam;
+	mat4	cam_to_world;
+	mat4	cam_to_clip;
+	mat4	skybox_to_clip;
+	vec2	screen_dim;
+	vec2	mcursor_pos;
+};
+
+layout(std140) uniform Object { // per drawn mesh, instanced draws use the instance_ attributes instead (see mesh_vertex.vert)
+	mat4	model_to_world;
+	vec4	model_col;
+};
@@ -0,0 +1,98 @@
+#include <emmintrin.h> // SSE2, always available on x64
+
+// Box downsampling of images by powers of two, for the texture resolution caps (see texture_max_res)
+//  srgb channels are averaged in linear space, averaging the srgb values directly darkens high contrast textures
+namespace downsample {
+	
+	// how often dim has to be halved to fit into max_dim, a component <= 0 means no limit
+	static u32 get_levels (iv2 dim, iv2 max_dim) {
+		u32 levels = 0;
+		while (	(max_dim.x > 0 && (dim.x >> levels) > max_dim.x) ||
+				(max_dim.y > 0 && (dim.y >> levels) > max_dim.y) ) ++levels;
+		return levels;
+	}
+	static iv2 get_dim (iv2 dim, u32 levels) {
+		return iv2(max(dim.x >> levels, 1), max(dim.y >> levels, 1));
+	}
+	
+	// the source texels that get averaged into texel i of the downsampled axis
+	static void get_box (s32 i, u32 levels, s32 src_size, s32* begin, s32* end) {
+		*begin = i << levels;
+		*end = min((i +1) << levels, src_size);
+	}
+	
+	static f32 const* get_srgb_to_linear_lut () {
+		static std::array<f32, 256> lut = [] () {
+			std::array<f32, 256> lut;
+			for (u32 i=0; i<256; ++i) {
+				f64 c = (f64)i / 255;
+				lut[i] = (f32)(c <= 0.04045 ? c / 12.92 : pow((c +0.055) / 1.055, 2.4));
+			}
+			return lut;
+		}();
+		return lut.data();
+	}
+	static f32 const* get_unorm_to_linear_lut () {
+		static std::array<f32, 256> lut = [] () {
+			std::array<f32, 256> lut;
+			for (u32 i=0; i<256; ++i) lut[i] = (f32)i / 255;
+			return lut;
+		}();
+		return lut.data();
+	}
+	static byte const* get_linear_to_srgb_lut () { // indexed with linear * 65535, fine enough that even the steep part near black rounds correctly
+		static std::vector<byte> lut = [] () {
+			std::vector<byte> lut (65536);
+			for (u32 i=0; i<65536; ++i) {
+				f64 l = (f64)i / 65535;
+				f64 c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) -0.055;
+				lut[i] = (byte)(c * 255 +0.5);
+			}
+			return lut;
+		}();
+		return lut.data();
+	}
+	
+	// 8 bit images with 3 or 4 channels, srgb means the rgb channels are srgb encoded (alpha is always linear)
+	//  dst needs room for get_dim(src_dim, levels), rows are done in parallel
+	static void image_u8 (byte const* src, iv2 src_dim, u64 src_stride, u32 channels, bool srgb, u32 levels, byte* dst, u64 dst_stride) {
+		dbg_assert(channels == 3 || channels == 4);
+		
+		iv2 dim = get_dim(src_dim, levels);
+		
+		f32 const* rgb_lut = srgb ? get_srgb_to_linear_lut() : get_unorm_to_linear_lut();
+		f32 const* alpha_lut = get_unorm_to_linear_lut();
+		byte const* to_srgb = get_linear_to_srgb_lut();
+		
+		parallel_for((u32)dim.y, [&] (u32 y) {
+			s32 y0, y1;
+			get_box((s32)y, levels, src_dim.y, &y0, &y1);
+			
+			byte* out = dst +y * dst_stride;
+			
+			for (s32 x=0; x<dim.x; ++x) {
+				s32 x0, x1;
+				get_box(x, levels, src_dim.x, &x0, &x1);
+				
+				__m128 sum = _mm_setzero_ps();
+				for (s32 sy=y0; sy<y1; ++sy) {
+					byte const* p = src +sy * src_stride +x0 * channels;
+					for (s32 sx=x0; sx<x1; ++sx) {
+						sum = _mm_add_ps(sum, _mm_setr_ps(rgb_lut[p[0]], rgb_lut[p[1]], rgb_lut[p[2]], channels == 4 ? alpha_lut[p[3]] : 1));
+						p += channels;
+					}
+				}
+				__m128 avg = _mm_mul_ps(sum, _mm_set1_ps(1.0f / (f32)((y1 -y0) * (x1 -x0))));
+				
+				s32 unorm[4], srgb_index[4];
+				_mm_storeu_si128((__m128i*)unorm, _mm_cvtps_epi32(_mm_mul_ps(avg, _mm_set1_ps(255))));
+				_mm_storeu_si128((__m128i*)srgb_index, _mm_cvtps_epi32(_mm_mul_ps(avg, _mm_set1_ps(65535))));
+				
+				for (u32 c=0; c<channels; ++c) {
+					out[c] = srgb && c < 3 ? to_srgb[srgb_index[c]] : (byte)unorm[c];
+				}
+				out += channels;
+			}
+		}, 16);
+	}
+}
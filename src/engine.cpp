@@ -1,12 +1,16 @@
 #include <cstdio>
+#include <cstdlib>
 #include <array>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <mutex>
 
 #include "types.hpp"
 #include "lang_helpers.hpp"
 #include "math.hpp"
 #include "vector/vector.hpp"
+#include "parallel.hpp"
 
 typedef s32v2	iv2;
 typedef s32v3	iv3;
@@ -29,6 +33,40 @@ typedef fhm		hm;
 #include "platform.hpp"
 
 
+// stb_image allocation hooks, so images can be decoded straight into memory we provide (see stbi_load_into)
+//  the first allocation that fits the target (stb allocates the output image at most 1 byte larger than the image) gets the target buffer, everything else uses malloc
+struct Stbi_Target {
+	void*	buf;
+	size_t	size;
+	size_t	capacity;
+};
+static thread_local Stbi_Target stbi_target = {};
+
+static void* stbi_malloc_hook (size_t size) {
+	if (stbi_target.buf && size >= stbi_target.size && size <= stbi_target.capacity) {
+		void* p = stbi_target.buf;
+		stbi_target.size = (size_t)-1; // hand out only once, but remember buf so free() can ignore it
+		return p;
+	}
+	return malloc(size);
+}
+static void stbi_free_hook (void* p) {
+	if (p && p == stbi_target.buf) return;
+	free(p);
+}
+static void* stbi_realloc_hook (void* p, size_t old_size, size_t new_size) {
+	if (p && p == stbi_target.buf) { // never happens for the output image, but would if the target got handed out for some temporary buffer
+		void* q = malloc(new_size);
+		if (q) memcpy(q, p, (size_t)min((u64)old_size, (u64)new_size));
+		return q;
+	}
+	return realloc(p, new_size);
+}
+
+#define STBI_MALLOC(size)							stbi_malloc_hook(size)
+#define STBI_FREE(p)								stbi_free_hook(p)
+#define STBI_REALLOC_SIZED(p, old_size, new_size)	stbi_realloc_hook(p, old_size, new_size)
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_STATIC
 #define STBI_ONLY_BMP	1
@@ -38,6 +76,31 @@ typedef fhm		hm;
 #define STBI_ONLY_HDR	1
 
 #include "stb_image.h"
+#include "png_decode.hpp"
+
+// decode an image into buf (size bytes, the image has to have exactly expected_dim and req_comp channels), buf needs at least size +1 bytes of room
+//  decodes directly into buf if stb allocates the output through our hook like expected, else copies
+static bool stbi_load_into (cstr filepath, iv2 expected_dim, int req_comp, byte* buf, u64 size) {
+	str ext;
+	get_fileext(filepath, &ext);
+	if (ext.compare("png") == 0 && png::load_into(filepath, expected_dim, req_comp, buf)) return true;
+	
+	stbi_target = { buf, (size_t)size, (size_t)size +1 };
+	
+	iv2 dim;
+	int n;
+	byte* res = stbi_load(filepath, &dim.x, &dim.y, &n, req_comp);
+	
+	stbi_target = {};
+	
+	if (!res) return false;
+	
+	bool ok = !any(dim != expected_dim); // file could have changed since we got the info
+	if (ok && res != buf) memcpy(buf, res, size);
+	
+	if (res != buf) free(res);
+	return ok;
+}
 
 #define STB_RECT_PACK_IMPLEMENTATION
 #define STBRP_STATIC
@@ -48,6 +111,7 @@ typedef fhm		hm;
 #include "stb_truetype.h"
 
 static std::vector< std::basic_string<utf32> >		console_log_lines;
+static std::mutex									console_log_mutex; // logged from the main and the render thread
 
 static void con_logf (cstr format, ...) {
 	std::string str;
@@ -59,7 +123,10 @@ static void con_logf (cstr format, ...) {
 	
 	va_end(vl);
 	
-	console_log_lines.push_back( utf8_to_utf32(str) );
+	{
+		std::lock_guard<std::mutex> lock (console_log_mutex);
+		console_log_lines.push_back( utf8_to_utf32(str) );
+	}
 	
 	str.push_back('\n');
 	printf(str.c_str());
@@ -75,7 +142,10 @@ static void con_logf_warning (cstr format, ...) {
 	
 	va_end(vl);
 	
-	console_log_lines.push_back( utf8_to_utf32(prints("[WARNING]  %s", str.c_str())) );
+	{
+		std::lock_guard<std::mutex> lock (console_log_mutex);
+		console_log_lines.push_back( utf8_to_utf32(prints("[WARNING]  %s", str.c_str())) );
+	}
 	
 	printf(ANSI_COLOUR_CODE_YELLOW "%s\n" ANSI_COLOUR_CODE_NC, str.c_str());
 }
@@ -84,6 +154,11 @@ static void con_logf_warning (cstr format, ...) {
 static cstr shaders_base_path =		"shaders/";
 static cstr meshes_base_path =		"assets_src";
 static cstr textures_base_path =	"assets_src";
+static cstr asset_cache_path =		"asset_cache/"; // data derived from assets_src, can always be deleted
+
+static void create_asset_cache_dir () {
+	CreateDirectoryA(asset_cache_path, NULL); // fails if it already exists, which is fine
+}
 
 struct Source_File {
 	str			filepath;
@@ -130,6 +205,13 @@ struct Source_File {
 		}
 		return did_change;
 	}
+	
+	// identifies this version of the file, for keying cached data derived from it
+	u64 get_change_key (u64 h=FNV1A_OFFSET_BASIS) const {
+		h = hash_fnv1a(filepath.data(), filepath.size(), h);
+		h = hash_fnv1a(&last_change_t, sizeof(last_change_t), h);
+		return h;
+	}
 };
 
 struct Source_Files {
@@ -139,6 +221,10 @@ struct Source_Files {
 		for (auto& i : v) if (i.poll_did_change()) return true;
 		return false;
 	}
+	u64 get_change_key (u64 h=FNV1A_OFFSET_BASIS) const {
+		for (auto& i : v) h = i.get_change_key(h);
+		return h;
+	}
 	void close_all () {
 		for (auto& i : v) i.close();
 	}
@@ -149,35 +235,44 @@ typedef u32 vert_indx_t;
 static bool startup;
 static void draw_loadinscreen_frame ();
 
+#include "downsample.hpp"
+#include "hdr_decode.hpp"
 #include "gl.hpp"
+#include "gpu_profiler.hpp"
 #include "font.hpp"
+#include "ibl_prefilter.hpp"
 
 static font::Font* console_font;
 
-#define UV2(name)	Uniform(T_V2, name)
-#define UV3(name)	Uniform(T_V3, name)
-#define UM4(name)	Uniform(T_M4, name)
-
 static std::vector<Shader*>			shaders;
 static std::vector<Texture2D*>		textures2d;
 static std::vector<TextureCube*>	texturesCube;
 
-static Shader* new_shader (strcr v, strcr f, std::initializer_list<Uniform> u, std::initializer_list<Shader::Uniform_Texture> t={}) {
-	Shader* s = new Shader(v,f,u,t);
+// defines select the permutation, see Shader::defines
+static Shader* new_shader (strcr v, strcr f, std::initializer_list<Shader::Uniform_Texture> t={}, std::initializer_list<str> defines={}) { // uniforms are queried from the program
+	Shader* s = new Shader(v,f,t,defines);
 	
-	s->load(); // NOTE: Load shaders instantly on creation
+	s->begin_load(); // only submits the compile, see finish_shader_loads()
 	
 	shaders.push_back(s);
 	return s;
 }
 
-static Texture2D* new_texture2d (strcr filename, src_color_space cs=CS_AUTO) {
-	auto* t = new File_Texture2D(cs, filename);
+// waits for the shaders created with new_shader to finish compiling
+//  call as late as possible before the shaders are needed, so the compiles overlap with loading the other assets
+static void finish_shader_loads () {
+	for (auto* s : shaders) {
+		if (s->is_load_pending()) s->finish_load();
+	}
+}
+
+static Texture2D* new_texture2d (strcr filename, src_color_space cs=CS_AUTO, iv2 max_res=0) {
+	auto* t = new File_Texture2D(cs, filename, max_res);
 	textures2d.push_back(t);
 	return t;
 }
-static File_TextureCube* new_textureCube (strcr filename, src_color_space cs=CS_AUTO) {
-	auto* t = new File_TextureCube(cs, filename);
+static File_TextureCube* new_textureCube (strcr filename, src_color_space cs=CS_AUTO, iv2 equirect_max_res=4096) {
+	auto* t = new File_TextureCube(cs, filename, equirect_max_res);
 	texturesCube.push_back(t);
 	return t;
 }
@@ -196,6 +291,14 @@ static TextureCube* new_textureCube (strcr filename_format, std::array<cstr, 6>c
 	return t;
 }
 
+static std::vector<Prefiltered_Env*>	prefiltered_envs;
+
+static Prefiltered_Env* new_prefiltered_env (strcr name, TextureCube* src, u32 spec_res=128, u32 sample_count=256) {
+	auto* e = new Prefiltered_Env(name, src, spec_res, sample_count);
+	prefiltered_envs.push_back(e);
+	return e;
+}
+
 //
 struct Mesh_Vertex {
 	v3	pos_model;
@@ -220,6 +323,26 @@ static Vertex_Layout mesh_vert_layout = {
 	{ "col",		T_V4, sizeof(Mesh_Vertex), offsetof(Mesh_Vertex, col) }
 };
 
+// tightly packed streams for depth only passes, generated from the Mesh_Vertex data (see Base_Mesh::gen_depth_stream)
+//  the attribute names are the same as in mesh_vert_layout, so depth.vert works with both
+struct Depth_Vertex {
+	v3	pos_model;
+};
+struct Depth_UV_Vertex { // for alpha tested meshes
+	v3	pos_model;
+	v2	uv;
+};
+
+static bool gen_depth_streams =		true;
+
+static Vertex_Layout depth_vert_layout = {
+	{ "pos_model",	T_V3, sizeof(Depth_Vertex), offsetof(Depth_Vertex, pos_model) },
+};
+static Vertex_Layout depth_uv_vert_layout = {
+	{ "pos_model",	T_V3, sizeof(Depth_UV_Vertex), offsetof(Depth_UV_Vertex, pos_model) },
+	{ "uv",			T_V2, sizeof(Depth_UV_Vertex), offsetof(Depth_UV_Vertex, uv) },
+};
+
 #include "mesh_loader.hpp"
 #include "shapes.hpp"
 
@@ -245,14 +368,30 @@ struct Base_Mesh {
 	v3			pos_world;
 	m3			ori;
 	v3			scale;
+	v4			col =					1; // multiplied with the vertex colors
 	
 	Shader*		shad;
 	Shader*		shad_transp_pass2; // only for meshes that use transparency
+	Shader*		shad_depth =			nullptr; // render_queue depth prepass variant, created on first use
 	
-	Vbo			vbo; // one vbo per mesh for now
+	Vbo			vbo; // geometry lives in the arena of mesh_vert_layout
+	Vbo			depth_vbo; // positions (and uvs if alpha tested) of vbo, for depth only passes
 	
 	std::vector<Allotted_Texture>	textures;
 	
+	// for texture streaming, model space bounding sphere and the average uv distance per model space distance
+	v3			bounds_center =			0;
+	f32			bounds_radius =			0;
+	f32			uv_per_model_unit =		0;
+	
+	u64			last_drawn_frame =		(u64)-1;
+	
+	u32			ubo_slot =				0; // this frames ubo::Object slot
+	u32			texture_set =			(u32)-1; // interned by render_queue on first use
+	
+	bool		is_static =				false; // never moves, so static_batching may merge it with others
+	Base_Mesh*	batched_into =			nullptr; // the static batch that draws this mesh, its own vbo is never uploaded
+	
 	Base_Mesh (strcr n, Shader* s, Shader* s2, v3 p, m3 o, std::initializer_list<Allotted_Texture> t={}) {
 		name = n;
 		
@@ -263,7 +402,8 @@ struct Base_Mesh {
 		shad =				s;
 		shad_transp_pass2 =	s2;
 		
-		vbo.init(&mesh_vert_layout);
+		vbo.init(&mesh_vert_layout, VBO_ARENA);
+		depth_vbo.init(s->has_define("ALPHA_TEST") ? &depth_uv_vert_layout : &depth_vert_layout, VBO_ARENA);
 		
 		textures = t;
 		
@@ -274,6 +414,56 @@ struct Base_Mesh {
 		return transl_rot_scale(pos_world, ori, scale);
 	}
 	
+	void calc_texel_density_info () { // call after loading
+		auto* verts = (Mesh_Vertex const*)vbo.vertecies.data();
+		u32 vert_count = (u32)(vbo.vertecies.size() / sizeof(Mesh_Vertex));
+		
+		bounds_center = 0;
+		bounds_radius = 0;
+		uv_per_model_unit = 0;
+		if (vert_count == 0) return;
+		
+		v3 lo = verts[0].pos_model;
+		v3 hi = verts[0].pos_model;
+		for (u32 i=1; i<vert_count; ++i) {
+			lo = min(lo, verts[i].pos_model);
+			hi = max(hi, verts[i].pos_model);
+		}
+		bounds_center = (lo +hi) / 2;
+		for (u32 i=0; i<vert_count; ++i) {
+			bounds_radius = max(bounds_radius, length(verts[i].pos_model -bounds_center));
+		}
+		
+		u32 tri_count = vbo.format_is_indexed() ? (u32)vbo.indices.size() / 3 : vert_count / 3;
+		
+		f64 area_model = 0;
+		f64 area_uv = 0;
+		for (u32 i=0; i<tri_count; ++i) {
+			auto& a = verts[ vbo.format_is_indexed() ? vbo.indices[i*3 +0] : i*3 +0 ];
+			auto& b = verts[ vbo.format_is_indexed() ? vbo.indices[i*3 +1] : i*3 +1 ];
+			auto& c = verts[ vbo.format_is_indexed() ? vbo.indices[i*3 +2] : i*3 +2 ];
+			
+			area_model += length(cross(b.pos_model -a.pos_model, c.pos_model -a.pos_model)) / 2;
+			
+			v2 ab = b.uv -a.uv;
+			v2 ac = c.uv -a.uv;
+			area_uv += fabs(ab.x * ac.y -ab.y * ac.x) / 2;
+		}
+		if (area_model > 0) uv_per_model_unit = (f32)sqrt(area_uv / area_model);
+	}
+	
+	v4 get_tex_layers () { // array layer per texture unit 0-3, for shaders that sample texture arrays
+		v4 layers = 0;
+		for (auto& t : textures) {
+			if (t.tex_unit < 4) layers[t.tex_unit] = (f32)t.tex->get_array_layer();
+		}
+		return layers;
+	}
+	void set_tex_layers (Shader* s) { // shader needs to be bound
+		auto* u = s->get_uniform("tex_layers");
+		if (u) u->set(get_tex_layers());
+	}
+	
 	void bind_textures () {
 		for (GLint tex_unit=0; tex_unit<MAX_TEXTURE_UNIT; ++tex_unit) {
 			bool tex_unit_used = false;
@@ -288,8 +478,33 @@ struct Base_Mesh {
 		for (auto& t : textures) t.bind();
 	}
 	
+	void gen_depth_stream () { // call after loading
+		depth_vbo.clear();
+		if (!gen_depth_streams) return;
+		
+		auto* verts = (Mesh_Vertex const*)vbo.vertecies.data();
+		u32 vert_count = (u32)(vbo.vertecies.size() / sizeof(Mesh_Vertex));
+		
+		if (depth_vbo.layout == &depth_uv_vert_layout) {
+			auto* out = (Depth_UV_Vertex*)&*vector_append(&depth_vbo.vertecies, vert_count * sizeof(Depth_UV_Vertex));
+			for (u32 i=0; i<vert_count; ++i) out[i] = { verts[i].pos_model, verts[i].uv };
+		} else {
+			auto* out = (Depth_Vertex*)&*vector_append(&depth_vbo.vertecies, vert_count * sizeof(Depth_Vertex));
+			for (u32 i=0; i<vert_count; ++i) out[i] = { verts[i].pos_model };
+		}
+		depth_vbo.indices = vbo.indices;
+	}
+	
+	void upload () {
+		gen_depth_stream();
+		
+		vbo.upload();
+		if (depth_vbo.vertecies.size() > 0) depth_vbo.upload();
+	}
+	
 	virtual void load () = 0;
 	virtual bool reload_if_needed () = 0;
+	virtual void source_changed () {} // a mesh batched into this one was reloaded
 };
 
 struct File_Mesh : public Base_Mesh {
@@ -331,7 +546,9 @@ struct File_Mesh : public Base_Mesh {
 		if (reloaded) {
 			con_logf("mesh source file changed, reloading mesh \"%s\".\n", filename.c_str());
 			load();
-			vbo.upload();
+			calc_texel_density_info();
+			if (batched_into)	batched_into->source_changed();
+			else				upload();
 		}
 		
 		return reloaded;
@@ -353,6 +570,112 @@ File_Mesh* new_transp_mesh (strcr n, strcr f, Shader* s, Shader* s2, v3 p, m3 o,
 	return m;
 }
 
+static std::vector<Texture2D_Array*>	texture_arrays;
+
+// Optional packing stage, groups textures with the same format, size and mip count into texture arrays
+//  so meshes that use the same kind of textures bind the exact same textures and only differ in the tex_layers uniform
+//  shaders opt in by handling TEX_ARRAYS (that permutation has to use the tex_layers uniform)
+//  a mesh switches to the TEX_ARRAYS permutation only if all its textures get packed, and a texture is only packed if all meshes using it switch
+//   so no mesh ever samples a packed texture with sampler2D or a plain one with sampler2DArray
+//  call after the textures were loaded and before they are uploaded
+static void pack_texture_arrays () {
+	
+	// submit the TEX_ARRAYS permutations of all shaders that have one first, so they compile in parallel, then wait for all of them
+	std::vector<std::pair<Shader*, Shader*>> array_variants; // shader -> variant, nullptr if it did not work out
+	auto request_variant = [&] (Shader* s) {
+		if (!s) return;
+		for (auto& v : array_variants) if (v.first == s) return;
+		
+		bool handles_tex_arrays = s->vert_src.find("TEX_ARRAYS") != str::npos || s->frag_src.find("TEX_ARRAYS") != str::npos;
+		array_variants.push_back({ s, handles_tex_arrays ? s->get_variant({ "TEX_ARRAYS" }) : nullptr });
+	};
+	for (auto* m : meshes) {
+		if (m->textures.size() == 0) continue;
+		request_variant(m->shad);
+		request_variant(m->shad_transp_pass2);
+	}
+	for (auto& v : array_variants) {
+		if (!v.second) continue;
+		if (v.second->is_load_pending()) v.second->finish_load();
+		if (!v.second->valid() || !v.second->get_uniform("tex_layers")) v.second = nullptr;
+	}
+	auto get_array_variant = [&] (Shader* s) -> Shader* {
+		for (auto& v : array_variants) if (v.first == s) return v.second;
+		return nullptr;
+	};
+	
+	auto is_loaded_texture2d = [] (Texture* t) {
+		for (auto* t2d : textures2d) if (t2d == t) return t2d->mips.size() > 0; // else failed to load
+		return false; // cubemaps etc.
+	};
+	
+	std::vector<bool> switches (meshes.size());
+	for (u64 i=0; i<meshes.size(); ++i) {
+		auto* m = meshes[i];
+		
+		bool ok = m->textures.size() > 0 && get_array_variant(m->shad) && (!m->shad_transp_pass2 || get_array_variant(m->shad_transp_pass2));
+		for (auto& at : m->textures) ok = ok && is_loaded_texture2d(at.tex);
+		switches[i] = ok;
+	}
+	
+	// a mesh sharing a texture with a mesh that can not switch can not switch either, until nothing changes
+	for (bool changed=true; changed;) {
+		changed = false;
+		for (u64 i=0; i<meshes.size(); ++i) {
+			if (switches[i]) continue;
+			
+			for (auto& at : meshes[i]->textures) {
+				for (u64 j=0; j<meshes.size(); ++j) {
+					if (!switches[j]) continue;
+					
+					for (auto& at2 : meshes[j]->textures) {
+						if (at2.tex != at.tex) continue;
+						switches[j] = false;
+						changed = true;
+						break;
+					}
+				}
+			}
+		}
+	}
+	
+	u32 packed_count = 0;
+	
+	for (auto* t : textures2d) {
+		bool used = false;
+		for (u64 i=0; i<meshes.size(); ++i) {
+			if (!switches[i]) continue;
+			for (auto& at : meshes[i]->textures) used = used || at.tex == t;
+		}
+		if (!used) continue; // by the fixpoint all its users switch if any does
+		
+		Texture2D_Array* arr = nullptr;
+		for (auto* a : texture_arrays) {
+			if (a->can_hold(t)) {
+				arr = a;
+				break;
+			}
+		}
+		if (!arr) {
+			arr = new Texture2D_Array();
+			texture_arrays.push_back(arr);
+		}
+		
+		arr->add_layer(t);
+		++packed_count;
+	}
+	
+	for (u64 i=0; i<meshes.size(); ++i) {
+		if (!switches[i]) continue;
+		
+		auto* m = meshes[i];
+		m->shad = get_array_variant(m->shad);
+		if (m->shad_transp_pass2) m->shad_transp_pass2 = get_array_variant(m->shad_transp_pass2);
+	}
+	
+	if (packed_count > 0) con_logf("packed %u textures into %u texture arrays", packed_count, (u32)texture_arrays.size());
+}
+
 struct Gen_Mesh_Floor : public Base_Mesh {
 	
 	Gen_Mesh_Floor (strcr n, Shader* s, std::initializer_list<Allotted_Texture> t={}):
@@ -452,6 +775,12 @@ Gen_Mesh_Iso_Sphere* new_gen_iso_sphere (strcr n, Shader* s, v3 p, m3 o, f32 r,
 	return m;
 }
 
+#include "texture_streaming.hpp"
+#include "render_queue.hpp"
+#include "static_batching.hpp"
+#include "frame_pacing.hpp"
+#include "render_thread.hpp"
+
 //
 static f32			dt = 0;
 
@@ -540,6 +869,13 @@ static void glfw_key_event (GLFWwindow* window, int key, int scancode, int actio
 		if (!alt) {
 			switch (key) {
 				case GLFW_KEY_F11:			if (went_down) {		toggle_fullscreen(); }	break;
+				case GLFW_KEY_F3:			if (went_down) {		render_thread::settings.shader_debug ^= true; }	break;
+				case GLFW_KEY_F4:			if (went_down) {		render_thread::settings.depth_prepass ^= true; }	break;
+				case GLFW_KEY_F5:			if (went_down) {		render_thread::settings.gpu_profiler_overlay ^= true; }	break;
+				case GLFW_KEY_F6:			if (went_down) {		render_thread::settings.gpu_profiler_csv ^= true; con_logf("gpu profiler csv %s", render_thread::settings.gpu_profiler_csv ? "on" : "off"); }	break;
+				case GLFW_KEY_F7:			if (went_down) {		render_thread::settings.render_stats_overlay ^= true; }	break;
+				case GLFW_KEY_F8:			if (went_down) {		render_thread::settings.low_latency ^= true; con_logf("low latency mode %s", render_thread::settings.low_latency ? "on" : "off"); }	break;
+				case GLFW_KEY_F9:			if (went_down) {		render_thread::settings.max_frames_in_flight = render_thread::settings.max_frames_in_flight == 1 ? 2 : 1; con_logf("max frames in flight %u", render_thread::settings.max_frames_in_flight); }	break;
 				
 				//
 				case GLFW_KEY_A:			inp.move_dir.x -= went_down ? +1 : -1;		break;
@@ -600,6 +936,8 @@ static void draw_console_log_text (v4 text_col) {
 	
 	u32 max_fully_visible_lines = max( (u32)1, (u32)floor((f32)inp.wnd_dim.y / console_font->line_height) );
 	
+	std::lock_guard<std::mutex> lock (console_log_mutex);
+	
 	u32 max_buffered_lines = 1000;
 	if (console_log_lines.size() > max_buffered_lines) { // only keep at most max_buffered_lines lines
 		console_log_lines.erase( console_log_lines.begin(), console_log_lines.begin() +(console_log_lines.size() -max_buffered_lines));
@@ -614,20 +952,81 @@ static void draw_console_log_text (v4 text_col) {
 	}
 	
 	if (shad_font->valid()) {
-		glEnable(GL_BLEND);
-		glDisable(GL_DEPTH_TEST);
-		glDisable(GL_CULL_FACE);
+		gl_state::set_render_state(gl_state::RS_OVERLAY);
 		
 		shad_font->bind();
-		shad_font->set_unif("screen_dim", (v2)inp.wnd_dim);
 		bind_texture_unit(0, &console_font->tex);
 		
 		vbo_console_font.upload();
-		vbo_console_font.draw_entire(shad_font);
+		vbo_console_font.draw_entire();
+	}
+}
+
+static Vbo		vbo_gpu_profiler_text;
+
+// the last read back gpu_profiler results as text with a bar per scope
+//  pos_y_px is the baseline of the first line and gets advanced past the last one
+static void draw_gpu_profiler_overlay (f32* pos_y_px) {
+	f32 ms_per_block = 0.25f;
+	u32 max_blocks = 80;
+	
+	vbo_gpu_profiler_text.clear();
+	
+	auto line = [&] (std::basic_string<utf32> const& l) {
+		console_font->draw_line(&vbo_gpu_profiler_text.vertecies, *pos_y_px, shad_font, l, v4(1,1,1,1));
+		*pos_y_px += console_font->line_height;
+	};
+	
+	line(utf8_to_utf32(prints("gpu frame %llu  (%llu skipped, %llu scopes dropped)", gpu_profiler::results_frame, gpu_profiler::skipped_frames, gpu_profiler::dropped_scopes)));
+	
+	for (auto& r : gpu_profiler::results) {
+		u32 indent = r.depth * 2;
+		auto l = utf8_to_utf32(prints("%*s%-*s %7.3f ms ", indent, "", 20 -min(indent, (u32)20), r.name, r.ms));
 		
-		glEnable(GL_CULL_FACE);
-		glEnable(GL_DEPTH_TEST);
-		glDisable(GL_BLEND);
+		u32 blocks = min((u32)(r.ms / ms_per_block +0.5), max_blocks);
+		l.append(blocks, U'\x2588');
+		
+		line(l);
+	}
+	
+	if (shad_font->valid()) {
+		gl_state::set_render_state(gl_state::RS_OVERLAY);
+		
+		shad_font->bind();
+		bind_texture_unit(0, &console_font->tex);
+		
+		vbo_gpu_profiler_text.upload();
+		vbo_gpu_profiler_text.draw_entire();
+	}
+}
+
+static Vbo		vbo_render_stats_text;
+
+// render_stats of the last frame and min/avg/max over the window
+static void draw_render_stats_overlay (f32* pos_y_px) {
+	vbo_render_stats_text.clear();
+	
+	auto line = [&] (str const& l) {
+		console_font->draw_line(&vbo_render_stats_text.vertecies, *pos_y_px, shad_font, utf8_to_utf32(l), v4(1,1,1,1));
+		*pos_y_px += console_font->line_height;
+	};
+	
+	auto last = render_stats::get_last();
+	auto sum = render_stats::summarize();
+	
+	line(prints("render stats (%u frames)  %12s %12s %12s %12s", sum.frames, "last", "min", "avg", "max"));
+	for (u32 s=0; s<render_stats::STATS; ++s) {
+		line(prints("%-20s %12llu %12.0f %12.1f %12.0f", render_stats::NAMES[s], last.v[s], sum.min[s], sum.avg[s], sum.max[s]));
+	}
+	
+	if (shad_font->valid()) {
+		gl_state::set_render_state(gl_state::RS_OVERLAY);
+		
+		shad_font->bind();
+		bind_texture_unit(0, &console_font->tex);
+		
+		vbo_render_stats_text.upload();
+		vbo_render_stats_text.draw_entire();
 	}
 }
 
@@ -635,6 +1034,8 @@ static void draw_loadinscreen_frame () {
 	
 	glfwSetWindowTitle(wnd, prints("loading...").c_str());
 	
+	stream_buffer::begin_frame();
+	
 	inp.mouse_look_diff = 0;
 	
 	glfwPollEvents();
@@ -645,10 +1046,25 @@ static void draw_loadinscreen_frame () {
 	
 	v4 clear_color = v4(srgb(41,49,52)*3, 1);
 	glClearColor(clear_color.x,clear_color.y,clear_color.z,clear_color.w);
+	gl_state::set_render_state(gl_state::RS_OPAQUE); // depth_write for the clear
 	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 	
+	{ // no camera yet, the font only needs screen_dim
+		ubo::View view;
+		view.world_to_cam =		m4::ident();
+		view.cam_to_world =		m4::ident();
+		view.cam_to_clip =		m4::ident();
+		view.skybox_to_clip =	m4::ident();
+		view.screen_dim =		(v2)inp.wnd_dim;
+		view.mcursor_pos =		inp.bottom_up_mcursor_pos();
+		ubo::set_view(view);
+	}
+	
 	draw_console_log_text(v4(1,1,1,1));
 	
+	gl_state::end_frame();
+	render_stats::end_frame();
+	stream_buffer::end_frame();
 	glfwSwapBuffers(wnd);
 }
 
@@ -656,13 +1072,21 @@ int main (int argc, char** argv) {
 	
 	cstr app_name = "lib_engine";
 	
+	for (int i=1; i<argc; ++i) {
+		if (strcmp(argv[i], "--texture_max_res") == 0 && i +1 < argc) texture_max_res = atoi(argv[++i]); // textures larger than this are halved until they fit when loaded, <= 0 is no cap
+		if (strcmp(argv[i], "--no_render_thread") == 0) render_thread::enable = false;
+		if (strcmp(argv[i], "--low_latency") == 0 && i +1 < argc) { frame_pacing::low_latency = true; frame_pacing::max_frames_in_flight = (u32)atoi(argv[++i]); } // 1 or 2
+		if (strcmp(argv[i], "--vsync") == 0 && i +1 < argc) vsync_mode = atoi(argv[++i]);
+		if (strcmp(argv[i], "--fps_limit") == 0 && i +1 < argc) frame_pacing::fps_limit = atof(argv[++i]); // with --vsync 0
+	}
+	
 	platform_setup_context_and_open_window(app_name, iv2(1280, 720));
 	
 	//
 	load_game();
 	
 	//
-	set_vsync(1);
+	set_vsync(vsync_mode);
 	
 	{ // GL state
 		glEnable(GL_FRAMEBUFFER_SRGB);
@@ -681,16 +1105,27 @@ int main (int argc, char** argv) {
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		
 		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &max_aniso);
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_array_texture_layers);
 		
 		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+		
+		if (GLAD_GL_KHR_parallel_shader_compile) {
+			glMaxShaderCompilerThreadsKHR(0xffffffff); // let the driver decide
+			parallel_shader_compile = true;
+		} else if (GLAD_GL_ARB_parallel_shader_compile) {
+			glMaxShaderCompilerThreadsARB(0xffffffff);
+			parallel_shader_compile = true;
+		}
+		
+		stream_buffer::init();
+		ubo::init();
+		
+		gl_state::reset(); // everything above bypassed the cache
 	}
 	
 	startup = true;
 	
-	#define UCOM UV2("screen_dim"), UV2("mcursor_pos") // common uniforms
-	#define UMAT UM4("model_to_world"), UM4("world_to_cam"), UM4("cam_to_clip"), UM4("cam_to_world") // transformation uniforms
-	
-	shad_equirectangular_to_cubemap = new_shader("equirectangular_to_cubemap.vert",	"equirectangular_to_cubemap.frag", {UCOM}, {{0,"equirectangular"}});
+	shad_equirectangular_to_cubemap = new_shader("equirectangular_to_cubemap.vert",	"equirectangular_to_cubemap.frag", {{0,"equirectangular"}});
 	
 	{ // init game console overlay
 		f32 sz =	16; // 14 16 24
@@ -700,21 +1135,27 @@ int main (int argc, char** argv) {
 			{ "consola.ttf",	sz,		  U'\xfffd' }, // missing glyph placeholder, must be the zeroeth glyph
 			{ "consola.ttf",	sz,		  U' ', U'~' },
 			{ "consola.ttf",	sz,		{ U'ß',U'Ä',U'Ö',U'Ü',U'ä',U'ö',U'ü' } }, // german umlaute
+			{ "consola.ttf",	sz,		  U'\x2588' }, // full block, for the gpu_profiler bars
 			{ "meiryo.ttc",		jpsz,	  U'\x3040', U'\x30ff' }, // hiragana +katakana
 			{ "meiryo.ttc",		jpsz,	{ U'　',U'、',U'。',U'”',U'「',U'」' } }, // some jp puncuation
 		};
 		
 		console_font = new font::Font(sz, ranges);
 		
-		vbo_console_font.init(&font::mesh_vert_layout);
-		shad_font = new_shader("font.vert", "font.frag", {UCOM}, {{0,"glyphs"}});
+		vbo_console_font.init(&font::mesh_vert_layout, VBO_STREAM); // rewritten every frame
+		vbo_gpu_profiler_text.init(&font::mesh_vert_layout, VBO_STREAM);
+		vbo_render_stats_text.init(&font::mesh_vert_layout, VBO_STREAM);
+		shad_font = new_shader("font.vert", "font.frag", {{0,"glyphs"}});
+		shad_font->finish_load(); // needed for the loading screen
 	}
 	
 	//
 	
-	auto* shad_skybox =				new_shader("skybox.vert",		"skybox.frag",			{UCOM, UM4("skybox_to_clip")});
-	auto* shad_overlay_tex =		new_shader("overlay_tex.vert",	"overlay_tex.frag",		{UCOM, UV2("pos_clip"), UV2("size_clip")}, {{0,"tex0"}});
-	auto* shad_overlay_cubemap =	new_shader("overlay_tex.vert",	"overlay_cubemap.frag",	{UCOM, UV2("pos_clip"), UV2("size_clip")}, {{0,"tex0"}});
+	auto* shad_skybox =				new_shader("skybox.vert",		"skybox.frag");
+	render_queue::shad_depth =		new_shader("depth.vert",		"depth.frag",			{{0,"albedo"}});
+	auto* shad_overlay_tex =		new_shader("overlay_tex.vert",	"overlay_tex.frag",		{{0,"tex0"}});
+	auto* shad_overlay_cubemap =	new_shader("overlay_tex.vert",	"overlay_cubemap.frag",	{{0,"tex0"}});
+	auto* shad_overlay_sh =			new_shader("overlay_tex.vert",	"overlay_cubemap.frag",	{}, {"SH_IRRADIANCE"});
 	
 	auto* tex_test =				new_texture2d("test/thinkin.png");
 	auto* tex_haha =				new_texture2d("test/haha.dds");
@@ -732,10 +1173,12 @@ int main (int argc, char** argv) {
 	auto* tex_test_cubemap1 =		new_textureCube("env_maps/humus/CNTower/$.jpg", HUMUS_CUBEMAP_FACE_CODES);
 	auto* tex_test_cubemap2 =		new_textureCube("env_maps/sibl/Alexs_Apartment/2k.hdr");
 	
+	auto* env_test_cubemap2 =		new_prefiltered_env("env_maps/sibl/Alexs_Apartment/2k.hdr", tex_test_cubemap2);
+	
 	/*
 	{ // Generated meshes
-		auto* shad_vc =			new_shader("mesh_vertex.vert",	"vertex_color.frag",	{UCOM, UMAT});
-		auto* shad_diff =		new_shader("mesh_vertex.vert",	"diffuse.frag",			{UCOM, UMAT}, {{0,"tex0"}});
+		auto* shad_vc =			new_shader("mesh_vertex.vert",	"vertex_color.frag");
+		auto* shad_diff =		new_shader("mesh_vertex.vert",	"diffuse.frag",			{{0,"tex0"}});
 		
 		new_gen_tile_floor("tile_floor",	shad_diff, {{0, new_texture2d("rz/tile2.png")}});
 		new_gen_tetrahedron("tetrahedron",	shad_vc,	v3(+2,+2,0),	rotate3_Z(deg(13)),		1.0f / (1 +1.0f/3));
@@ -744,14 +1187,14 @@ int main (int argc, char** argv) {
 		new_gen_iso_sphere("iso_sphere",	shad_vc,	v3(-3, 0,0),	m3::ident(),			0.5f, 64, 32);
 	}
 	{ // Meshes modeled by me
-		auto* shad2 =				new_shader("mesh_vertex.vert",	"normals.frag",			{UCOM, UMAT});
+		auto* shad2 =				new_shader("mesh_vertex.vert",	"normals.frag");
 		
 		new_mesh("pedestal",		"rz/pedestal.obj",			shad2,		v3(3,0,0),		rotate3_Z(deg(-70)));
 		new_mesh("multi_obj_test",	"rz/multi_obj_test.obj",	shad2,		v3(10,0,0),		rotate3_Z(deg(-78)));
 		
 	}
 	{ // Cerberus PBR gun
-		auto* shad_cerb =			new_shader("mesh_vertex.vert",	"cerberus.frag",		{UCOM, UMAT}, {{0,"albedo"}, {1,"normal"}, {2,"metallic"}, {3,"roughness"}});
+		auto* shad_cerb =			new_shader("mesh_vertex.vert",	"cerberus.frag",		{{0,"albedo"}, {1,"normal"}, {2,"metallic"}, {3,"roughness"}});
 		
 		auto* tex_cerb_albedo =		new_texture2d("cerberus/Cerberus_A.tga");
 		auto* tex_cerb_normal =		new_texture2d("cerberus/Cerberus_N.tga", TEX_LINEAR);
@@ -761,8 +1204,11 @@ int main (int argc, char** argv) {
 		new_mesh("cerberus",		"cerberus/cerberus.obj",	shad_cerb,	v3(0,0,1),		rotate3_Z(deg(45)), {{0,tex_cerb_albedo}, {1,tex_cerb_normal}, {2,tex_cerb_metallic}, {3,tex_cerb_roughness}});
 	}
 	{ // Nier models
-		auto* shad =			new_shader("mesh_vertex.vert",	"nier_alpha_test.frag",		{UCOM, UMAT}, {{0,"albedo"}, {1,"normal"}, {2,"a"}, {3,"b"}});
-		auto* shad2 =			new_shader("mesh_vertex.vert",	"nier_transp_pass2.frag",	{UCOM, UMAT}, {{0,"albedo"}, {1,"normal"}, {2,"a"}, {3,"b"}});
+		// the nier textures mostly share size and format, nier.frag has a TEX_ARRAYS permutation so pack_texture_arrays() can put them into a few texture arrays
+		u64 first_nier_mesh = meshes.size();
+		
+		auto* shad =			new_shader("mesh_vertex.vert",	"nier.frag",	{{0,"albedo"}, {1,"normal"}, {2,"a"}, {3,"b"}}, {"ALPHA_TEST"});
+		auto* shad2 =			new_shader("mesh_vertex.vert",	"nier.frag",	{{0,"albedo"}, {1,"normal"}, {2,"a"}, {3,"b"}});
 		
 		typedef std::initializer_list<Allotted_Texture>	TL;
 		{
@@ -854,6 +1300,9 @@ int main (int argc, char** argv) {
 			
 			new_mesh("sword L",		"nier/sword_large.obj",		shad,	v3(-4,-2,0),	rotate3_Z(deg(90)),	texs);
 		}
+		
+		// the parts never move, so the ones sharing textures get merged by static_batching
+		for (u64 i=first_nier_mesh; i<meshes.size(); ++i) meshes[i]->is_static = true;
 	}
 	*/
 	
@@ -861,37 +1310,30 @@ int main (int argc, char** argv) {
 	for (auto* i : textures2d)		i->load();
 	for (auto* i : texturesCube)	i->load();
 	
-	for (auto* i : meshes)			i->vbo.upload();
-	for (auto* i : textures2d)		i->upload();
+	for (auto* i : meshes)			i->calc_texel_density_info();
+	
+	static_batching::build();
+	
+	finish_shader_loads(); // compiled while we were loading, needed from here on (active uniforms for pack_texture_arrays, equirectangular_to_cubemap)
+	
+	pack_texture_arrays();
+	texture_streaming::init(); // after packing, packed textures are not streamed
+	
+	for (auto* i : meshes)			if (!i->batched_into) i->upload();
+	for (auto* i : textures2d)		if (!i->packed_array) i->upload();
+	for (auto* i : texture_arrays)	i->upload();
 	for (auto* i : texturesCube)	i->upload();
 	
-	startup = false;
+	for (auto* i : prefiltered_envs)	i->update(); // after the source textures are loaded
 	
-	// 
-	f64 prev_t = glfwGetTime();
-	f32 avg_dt = 1.0f / 60;
-	f32 avg_dt_alpha = 0.025f;
+	startup = false;
 	
-	for (u32 frame_i=0;; ++frame_i) {
-		
-		{ //
-			f32 fps = 1.0f / dt;
-			f32 dt_ms = dt * 1000;
-			
-			f32 avg_fps = 1.0f / avg_dt;
-			f32 avdt_ms = avg_dt * 1000;
-			
-			//printf("frame #%5d %6.1f fps %6.2f ms  avg: %6.1f fps %6.2f ms\n", frame_i, fps, dt_ms, avg_fps, avdt_ms);
-			glfwSetWindowTitle(wnd, prints("%s %6d  %6.1f fps avg %6.2f ms avg", app_name, frame_i, avg_fps, avdt_ms).c_str());
-		}
+	// everything gl does for a frame, on the render thread (or the main thread with --no_render_thread)
+	auto render_frame = [&] (render_thread::Frame_Packet const& p) {
+		stream_buffer::begin_frame();
+		gpu_profiler::begin_frame(p.frame_i);
 		
-		inp.mouse_look_diff = 0;
-		
-		glfwPollEvents();
-		
-		inp.get_non_callback_input();
-		
-		if (glfwWindowShouldClose(wnd)) break;
+		iv2 wnd_dim = p.wnd_dim;
 		
 		if (shad_equirectangular_to_cubemap->reload_if_needed()) {
 			tex_test_cubemap2->srcf.last_change_t = {}; // HACK
@@ -901,145 +1343,65 @@ int main (int argc, char** argv) {
 		for (auto* m : meshes)			m->reload_if_needed();
 		for (auto* t : textures2d)		t->reload_if_needed();
 		for (auto* t : texturesCube)	t->reload_if_needed();
+		for (auto* e : prefiltered_envs)	e->reload_if_needed();
 		
-		hm world_to_cam;
-		hm cam_to_world;
-		m4 cam_to_clip;
-		m4 skybox_to_clip;
-		{
-			{
-				v2 mouse_look_sens = v2(deg(1.0f / 8)) * (cam.vfov / deg(70));
-				cam.ori_ae -= inp.mouse_look_diff * mouse_look_sens;
-				cam.ori_ae.x = mymod(cam.ori_ae.x, deg(360));
-				cam.ori_ae.y = clamp(cam.ori_ae.y, deg(2), deg(180.0f -2));
-				
-				//printf(">>> %f %f\n", to_deg(camera_ae.x), to_deg(camera_ae.y));
-			}
-			m3 world_to_cam_rot = rotate3_X(-cam.ori_ae.y) * rotate3_Z(-cam.ori_ae.x);
-			m3 cam_to_world_rot = rotate3_Z(cam.ori_ae.x) * rotate3_X(cam.ori_ae.y);
-			
-			{
-				f32 cam_vel_forw = cam.fly_vel;
-				if (inp.move_fast) cam_vel_forw *= cam.fly_vel_fast_mul;
-				
-				v3 cam_vel = cam_vel_forw * v3(1,2.0f/3,1);
-				
-				v3 cam_vel_cam = normalize_or_zero( (v3)inp.move_dir ) * cam_vel;
-				cam.pos_world += (cam_to_world_rot * cam_vel_cam) * dt;
-				
-				//printf(">>> %f %f %f\n", cam_vel_cam.x, cam_vel_cam.y, cam_vel_cam.z);
-			}
-			world_to_cam = world_to_cam_rot * translateH(-cam.pos_world);
-			cam_to_world =translateH(cam.pos_world) * cam_to_world_rot;
-			
-			{
-				f32 vfov =			cam.vfov;
-				f32 clip_near =		1.0f/256;
-				f32 clip_far =		512;
-				
-				v2 frust_scale;
-				frust_scale.y = tan(vfov / 2);
-				frust_scale.x = frust_scale.y * inp.wnd_dim_aspect.x;
-				
-				v2 frust_scale_inv = 1.0f / frust_scale;
-				
-				f32 x = frust_scale_inv.x;
-				f32 y = frust_scale_inv.y;
-				f32 a = (clip_far +clip_near) / (clip_near -clip_far);
-				f32 b = (2.0f * clip_far * clip_near) / (clip_near -clip_far);
-				
-				cam_to_clip = m4::row(
-								x, 0, 0, 0,
-								0, y, 0, 0,
-								0, 0, a, b,
-								0, 0, -1, 0 );
-			}
+		{ // one buffer write for everything the shaders need per frame
+			ubo::set_view(p.view);
 			
-			skybox_to_clip = cam_to_clip * world_to_cam_rot;
-		}
-		
-		for (auto* s : shaders) {
-			if (s->valid()) {
-				s->bind();
-				s->set_unif("screen_dim", (v2)inp.wnd_dim);
-				s->set_unif("mcursor_pos", inp.bottom_up_mcursor_pos());
-			}
+			ubo::begin_objects();
+			u32 obj = 0;
+			for (auto* m : meshes_opaque)		m->ubo_slot = ubo::push_object(p.objects[obj++]);
+			for (auto* m : meshes_translucent)	m->ubo_slot = ubo::push_object(p.objects[obj++]);
+			ubo::upload_objects();
 		}
 		
-		glViewport(0,0, inp.wnd_dim.x,inp.wnd_dim.y);
+		glViewport(0,0, wnd_dim.x,wnd_dim.y);
 		
+		gpu_profiler::begin_scope("skybox");
 		if (1) { // draw skybox
 			
 			if (shad_skybox->valid()) {
-				glDisable(GL_DEPTH_TEST);
+				gl_state::set_render_state(gl_state::RS_SKYBOX);
 				
-				shad_skybox->bind();
-				shad_skybox->set_unif("skybox_to_clip", skybox_to_clip);
+				shad_skybox->get_draw_variant()->bind();
 				
 				// Coordinates generated in vertex shader
-				glBindBuffer(GL_ARRAY_BUFFER, 0);
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+				gl_state::bind_vertex_array(vao); // the global one without any attributes
 				glDrawArrays(GL_TRIANGLES, 0, 6*6);
-				
-				glEnable(GL_DEPTH_TEST);
+				render_stats::draw(12);
 			}
 		} else { // draw clear color
 			v4 clear_color = v4(srgb(41,49,52)*3, 1);
 			glClearColor(clear_color.x,clear_color.y,clear_color.z,clear_color.w);
 			glClear(GL_COLOR_BUFFER_BIT);
 		}
-		glClear(GL_DEPTH_BUFFER_BIT);
+		gpu_profiler::end_scope();
 		
-		for (auto* m : meshes_opaque) {
-			if (m->shad->valid()) {
-				m->bind_textures();
-				
-				hm model_to_world = m->get_transform();
-				
-				m->shad->bind();
-				m->shad->set_unif("model_to_world",	model_to_world.m4());
-				m->shad->set_unif("world_to_cam",	world_to_cam.m4());
-				m->shad->set_unif("cam_to_clip",	cam_to_clip);
-				m->shad->set_unif("cam_to_world",	cam_to_world.m4());
-				
-				m->vbo.draw_entire(m->shad);
-			}
-		}
+		gl_state::set_render_state(gl_state::RS_OPAQUE); // also needs depth_write for the clear
+		glClear(GL_DEPTH_BUFFER_BIT);
 		
-		for (auto* m : meshes_translucent) {
-			
-			m->bind_textures();
+		{
+			render_queue::begin();
 			
-			hm model_to_world = m->get_transform();
+			auto dist = [&] (u32 obj, Base_Mesh* m) {
+				v3 center_world = (p.objects[obj].model_to_world * v4(m->bounds_center, 1)).xyz();
+				return length(p.world_to_cam * center_world);
+			};
+			u32 obj = 0;
+			for (auto* m : meshes_opaque)		render_queue::record_mesh(m, render_queue::PASS_OPAQUE, dist(obj++, m));
+			for (auto* m : meshes_translucent)	render_queue::record_mesh(m, render_queue::PASS_TRANSLUCENT, dist(obj++, m));
 			
-			if (m->shad->valid()) {
-				m->shad->bind();
-				m->shad->set_unif("model_to_world",	model_to_world.m4());
-				m->shad->set_unif("world_to_cam",	world_to_cam.m4());
-				m->shad->set_unif("cam_to_clip",	cam_to_clip);
-				m->shad->set_unif("cam_to_world",	cam_to_world.m4());
-				
-				m->vbo.draw_entire(m->shad);
-			}
-			if (m->shad_transp_pass2->valid()) { 
-				glDepthMask(GL_FALSE);
-				glEnable(GL_BLEND);
-				glDepthFunc(GL_LESS);
+			render_queue::sort();
+			render_queue::execute(p.objects);
 			
-				m->shad_transp_pass2->bind();
-				m->shad_transp_pass2->set_unif("model_to_world",	model_to_world.m4());
-				m->shad_transp_pass2->set_unif("world_to_cam",	world_to_cam.m4());
-				m->shad_transp_pass2->set_unif("cam_to_clip",	cam_to_clip);
-				m->shad_transp_pass2->set_unif("cam_to_world",	cam_to_world.m4());
-				
-				m->vbo.draw_entire(m->shad_transp_pass2);
-				
-				glDepthFunc(GL_LEQUAL);
-				glDisable(GL_BLEND);
-				glDepthMask(GL_TRUE);
-			}
+			// only the drawn ones, batched sources have no ubo_slot (their batch is a texture user itself)
+			for (auto* m : meshes_opaque)		m->last_drawn_frame = p.frame_i;
+			for (auto* m : meshes_translucent)	m->last_drawn_frame = p.frame_i;
 		}
 		
+		texture_streaming::update(p.frame_i, p.world_to_cam, p.vfov, wnd_dim.y, p.objects);
+		
+		gpu_profiler::begin_scope("overlay");
 		{
 			v2 LL = v2(0,0);
 			v2 LR = v2(1,0);
@@ -1053,26 +1415,21 @@ int main (int argc, char** argv) {
 				}
 				
 				v2 size_screen = (v2)tex->dim * size_multiplier;
-				v2 size_clip = size_screen / ((v2)inp.wnd_dim / 2);
+				v2 size_clip = size_screen / ((v2)wnd_dim / 2);
 				
 				// pos is the lower left corner of the quad
-				v2 pos_screeen = ((v2)inp.wnd_dim -size_screen) * pos01; // [0,1] => [touches ll corner of screen, touches ur corner of screen]
+				v2 pos_screeen = ((v2)wnd_dim -size_screen) * pos01; // [0,1] => [touches ll corner of screen, touches ur corner of screen]
 				
-				v2 pos_clip = (pos_screeen / (v2)inp.wnd_dim) * 2 -1;
+				v2 pos_clip = (pos_screeen / (v2)wnd_dim) * 2 -1;
 				
-				glEnable(GL_BLEND);
-				glDisable(GL_DEPTH_TEST);
-				glDisable(GL_CULL_FACE);
+				gl_state::set_render_state(gl_state::RS_OVERLAY);
 				
 				shad_overlay_tex->bind();
 				shad_overlay_tex->set_unif("pos_clip", pos_clip);
 				shad_overlay_tex->set_unif("size_clip", size_clip);
 				bind_texture_unit(0, tex);
 				glDrawArrays(GL_TRIANGLES, 0, 6);
-				
-				glEnable(GL_CULL_FACE);
-				glEnable(GL_DEPTH_TEST);
-				glDisable(GL_BLEND);
+				render_stats::draw(2);
 			};
 			auto draw_overlay_texCube = [&] (Texture* tex, v2 pos01, v2 size_px) {
 				if (!shad_overlay_cubemap->valid()) {
@@ -1081,26 +1438,40 @@ int main (int argc, char** argv) {
 				}
 				
 				v2 size_screen = size_px;
-				v2 size_clip = size_screen / ((v2)inp.wnd_dim / 2);
+				v2 size_clip = size_screen / ((v2)wnd_dim / 2);
 				
 				// pos is the lower left corner of the quad
-				v2 pos_screeen = ((v2)inp.wnd_dim -size_screen) * pos01; // [0,1] => [touches ll corner of screen, touches ur corner of screen]
+				v2 pos_screeen = ((v2)wnd_dim -size_screen) * pos01; // [0,1] => [touches ll corner of screen, touches ur corner of screen]
 				
-				v2 pos_clip = (pos_screeen / (v2)inp.wnd_dim) * 2 -1;
+				v2 pos_clip = (pos_screeen / (v2)wnd_dim) * 2 -1;
 				
-				glEnable(GL_BLEND);
-				glDisable(GL_DEPTH_TEST);
-				glDisable(GL_CULL_FACE);
+				gl_state::set_render_state(gl_state::RS_OVERLAY);
 				
 				shad_overlay_cubemap->bind();
 				shad_overlay_cubemap->set_unif("pos_clip", pos_clip);
 				shad_overlay_cubemap->set_unif("size_clip", size_clip);
 				bind_texture_unit(0, tex);
 				glDrawArrays(GL_TRIANGLES, 0, 6);
+				render_stats::draw(2);
+			};
+			// the SH irradiance of env, in the same projection as draw_overlay_texCube
+			auto draw_overlay_sh_irradiance = [&] (Prefiltered_Env* env, v2 pos01, v2 size_px) {
+				if (!shad_overlay_sh->valid()) {
+					dbg_assert(false);
+					return;
+				}
+				
+				v2 size_clip = size_px / ((v2)wnd_dim / 2);
+				v2 pos_clip = ((((v2)wnd_dim -size_px) * pos01) / (v2)wnd_dim) * 2 -1;
+				
+				gl_state::set_render_state(gl_state::RS_OVERLAY);
 				
-				glEnable(GL_CULL_FACE);
-				glEnable(GL_DEPTH_TEST);
-				glDisable(GL_BLEND);
+				shad_overlay_sh->bind();
+				shad_overlay_sh->set_unif("pos_clip", pos_clip);
+				shad_overlay_sh->set_unif("size_clip", size_clip);
+				shad_overlay_sh->set_unif("sh_irradiance", env->sh_irradiance, 9);
+				glDrawArrays(GL_TRIANGLES, 0, 6);
+				render_stats::draw(2);
 			};
 			
 			if (shad_overlay_tex->valid()) {
@@ -1111,14 +1482,147 @@ int main (int argc, char** argv) {
 				draw_overlay_tex2d(tex_test_cubemap2->equirect, LL, 1.0f/4);
 			}
 			if (shad_overlay_cubemap->valid()) {
-				draw_overlay_texCube(tex_test_cubemap1, UR, (v2)min(inp.wnd_dim.x, inp.wnd_dim.y) / 2);
-				draw_overlay_texCube(tex_test_cubemap2, UL, (v2)min(inp.wnd_dim.x, inp.wnd_dim.y) / 2);
+				draw_overlay_texCube(tex_test_cubemap1, UR, (v2)min(wnd_dim.x, wnd_dim.y) / 2);
+				draw_overlay_texCube(tex_test_cubemap2, UL, (v2)min(wnd_dim.x, wnd_dim.y) / 2);
+				
+				draw_overlay_texCube(&env_test_cubemap2->specular, LR, (v2)min(wnd_dim.x, wnd_dim.y) / 4);
+			}
+			if (shad_overlay_sh->valid()) {
+				draw_overlay_sh_irradiance(env_test_cubemap2, v2(1, 0.5f), (v2)min(wnd_dim.x, wnd_dim.y) / 4);
 			}
 		}
 		
 		if (0) draw_console_log_text(v4(0,0,0, 1));
+		{
+			f32 pos_y_px = console_font->ascent_plus_gap;
+			if (gpu_profiler::show_overlay)	draw_gpu_profiler_overlay(&pos_y_px);
+			if (render_stats::show_overlay)	draw_render_stats_overlay(&pos_y_px);
+		}
+		gpu_profiler::end_scope();
 		
+		gpu_profiler::end_frame();
+		gl_state::end_frame();
+		render_stats::end_frame();
+		stream_buffer::end_frame();
 		glfwSwapBuffers(wnd);
+	};
+	
+	render_thread::start(render_frame);
+	
+	// 
+	f64 prev_t = glfwGetTime();
+	f32 avg_dt = 1.0f / 60;
+	f32 avg_dt_alpha = 0.025f;
+	
+	for (u32 frame_i=0;; ++frame_i) {
+		
+		{ //
+			auto stats = render_thread::get_stats(); // of the last frame the render thread finished
+			
+			f32 fps = 1.0f / dt;
+			f32 dt_ms = dt * 1000;
+			
+			f32 avg_fps = 1.0f / avg_dt;
+			f32 avdt_ms = avg_dt * 1000;
+			
+			auto ft = frame_pacing::frame_times.summarize();
+			
+			//printf("frame #%5d %6.1f fps %6.2f ms  avg: %6.1f fps %6.2f ms\n", frame_i, fps, dt_ms, avg_fps, avdt_ms);
+			glfwSetWindowTitle(wnd, prints("%s %6d  %6.1f fps avg %6.2f ms avg  stddev %5.2f ms max %6.2f ms  latency %6.2f ms max %6.2f ms%s  gl calls %llu skipped %llu",
+					app_name, frame_i, avg_fps, avdt_ms, ft.stddev, ft.max, stats.latency.avg, stats.latency.max, render_thread::settings.low_latency ? " (low latency)" : "",
+					stats.gl_calls, stats.gl_calls_skipped).c_str());
+		}
+		
+		frame_pacing::limit_frame_rate();
+		
+		auto* p = render_thread::begin_packet(); // before sampling input, so the packet starts with the newest input
+		
+		inp.mouse_look_diff = 0;
+		
+		glfwPollEvents();
+		
+		inp.get_non_callback_input();
+		
+		p->input_t = glfwGetTime();
+		
+		if (glfwWindowShouldClose(wnd)) break;
+		
+		hm world_to_cam;
+		hm cam_to_world;
+		m4 cam_to_clip;
+		m4 skybox_to_clip;
+		{
+			{
+				v2 mouse_look_sens = v2(deg(1.0f / 8)) * (cam.vfov / deg(70));
+				cam.ori_ae -= inp.mouse_look_diff * mouse_look_sens;
+				cam.ori_ae.x = mymod(cam.ori_ae.x, deg(360));
+				cam.ori_ae.y = clamp(cam.ori_ae.y, deg(2), deg(180.0f -2));
+				
+				//printf(">>> %f %f\n", to_deg(camera_ae.x), to_deg(camera_ae.y));
+			}
+			m3 world_to_cam_rot = rotate3_X(-cam.ori_ae.y) * rotate3_Z(-cam.ori_ae.x);
+			m3 cam_to_world_rot = rotate3_Z(cam.ori_ae.x) * rotate3_X(cam.ori_ae.y);
+			
+			{
+				f32 cam_vel_forw = cam.fly_vel;
+				if (inp.move_fast) cam_vel_forw *= cam.fly_vel_fast_mul;
+				
+				v3 cam_vel = cam_vel_forw * v3(1,2.0f/3,1);
+				
+				v3 cam_vel_cam = normalize_or_zero( (v3)inp.move_dir ) * cam_vel;
+				cam.pos_world += (cam_to_world_rot * cam_vel_cam) * dt;
+				
+				//printf(">>> %f %f %f\n", cam_vel_cam.x, cam_vel_cam.y, cam_vel_cam.z);
+			}
+			world_to_cam = world_to_cam_rot * translateH(-cam.pos_world);
+			cam_to_world =translateH(cam.pos_world) * cam_to_world_rot;
+			
+			{
+				f32 vfov =			cam.vfov;
+				f32 clip_near =		1.0f/256;
+				f32 clip_far =		512;
+				
+				v2 frust_scale;
+				frust_scale.y = tan(vfov / 2);
+				frust_scale.x = frust_scale.y * inp.wnd_dim_aspect.x;
+				
+				v2 frust_scale_inv = 1.0f / frust_scale;
+				
+				f32 x = frust_scale_inv.x;
+				f32 y = frust_scale_inv.y;
+				f32 a = (clip_far +clip_near) / (clip_near -clip_far);
+				f32 b = (2.0f * clip_far * clip_near) / (clip_near -clip_far);
+				
+				cam_to_clip = m4::row(
+								x, 0, 0, 0,
+								0, y, 0, 0,
+								0, 0, a, b,
+								0, 0, -1, 0 );
+			}
+			
+			skybox_to_clip = cam_to_clip * world_to_cam_rot;
+		}
+		
+		{ // the packet is all the render thread sees of this frame
+			p->frame_i =			frame_i;
+			p->wnd_dim =			inp.wnd_dim;
+			
+			p->view.world_to_cam =		world_to_cam.m4();
+			p->view.cam_to_world =		cam_to_world.m4();
+			p->view.cam_to_clip =		cam_to_clip;
+			p->view.skybox_to_clip =	skybox_to_clip;
+			p->view.screen_dim =		(v2)inp.wnd_dim;
+			p->view.mcursor_pos =		inp.bottom_up_mcursor_pos();
+			
+			p->world_to_cam =		world_to_cam;
+			p->vfov =				cam.vfov;
+			
+			p->objects.clear();
+			for (auto* m : meshes_opaque)		p->objects.push_back({ m->get_transform().m4(), m->col });
+			for (auto* m : meshes_translucent)	p->objects.push_back({ m->get_transform().m4(), m->col });
+			
+			render_thread::submit_packet(p);
+		}
 		
 		{
 			f64 now = glfwGetTime();
@@ -1126,9 +1630,12 @@ int main (int argc, char** argv) {
 			prev_t = now;
 			
 			avg_dt = lerp(avg_dt, dt, avg_dt_alpha);
+			frame_pacing::frame_times.push(dt * 1000);
 		}
 	}
 	
+	render_thread::stop();
+	
 	platform_terminate();
 	
 	return 0;
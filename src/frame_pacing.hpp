@@ -0,0 +1,113 @@
+#include <chrono>
+
+// Frame pacing, latency and frame time reporting
+//  every rendered frame ends with a fence, in low_latency mode the render thread waits until at most max_frames_in_flight frames are unfinished on the gpu
+//   instead of letting the driver queue several frames (with vsync each queued frame is another refresh of input lag)
+//   and the main thread only samples input once the render thread is idle (see render_thread::begin_packet), so input is as late as possible
+//  latency is measured from sampling input to the fence of that frame being signaled
+//   frames we had to wait for are measured exactly, others when we notice the fence on a later frame, so those are an upper bound
+//  the frame limiter is for vsync off runs, it sleeps until shortly before the deadline and spins the rest, because sleeps are coarse on windows
+namespace frame_pacing {
+	static f64				fps_limit =			0; // <= 0 is unlimited, ignored with vsync on (--fps_limit)
+	
+	static constexpr u32	MAX_QUEUED =		8; // frames we keep fences for without low_latency, the driver stops us long before that
+	
+	// the last WINDOW values of some timing in ms
+	struct Timing_Window {
+		static constexpr u32	WINDOW =	120;
+		
+		f64		vals[WINDOW];
+		u32		count =		0;
+		u32		next =		0;
+		
+		void push (f64 ms) {
+			vals[next] = ms;
+			next = (next +1) % WINDOW;
+			count = min(count +1, WINDOW);
+		}
+		
+		struct Summary {
+			f64		avg, stddev, max;
+		};
+		Summary summarize () const {
+			Summary s = {};
+			if (count == 0) return s;
+			
+			for (u32 i=0; i<count; ++i) {
+				s.avg += vals[i];
+				s.max = max(s.max, vals[i]);
+			}
+			s.avg /= count;
+			
+			f64 var = 0;
+			for (u32 i=0; i<count; ++i) var += (vals[i] -s.avg) * (vals[i] -s.avg);
+			s.stddev = sqrt(var / count);
+			return s;
+		}
+	};
+	
+	//// render thread
+	static bool				low_latency =			false; // set from render_thread::Settings
+	static u32				max_frames_in_flight =	1; // 1 or 2, 2 keeps the gpu busy while the cpu prepares the next frame at the cost of a frame of latency
+	
+	struct Queued_Frame {
+		GLsync	fence;
+		f64		input_t; // glfwGetTime() when its input was sampled
+	};
+	static std::vector<Queued_Frame>	queued;
+	static Timing_Window				latencies;
+	
+	// after the swap of every frame
+	static void end_frame (f64 input_t) {
+		queued.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), input_t });
+		
+		u32 limit = low_latency ? clamp(max_frames_in_flight, (u32)1, (u32)2) : MAX_QUEUED;
+		
+		while (queued.size() > 0) {
+			bool must_wait = (u32)queued.size() > limit;
+			
+			GLenum res = glClientWaitSync(queued[0].fence, GL_SYNC_FLUSH_COMMANDS_BIT, must_wait ? (GLuint64)1000000000 : 0); // 1s
+			dbg_assert(res != GL_WAIT_FAILED);
+			if (res == GL_TIMEOUT_EXPIRED) {
+				if (must_wait) continue;
+				break;
+			}
+			
+			latencies.push((glfwGetTime() -queued[0].input_t) * 1000);
+			
+			glDeleteSync(queued[0].fence);
+			queued.erase(queued.begin());
+		}
+	}
+	
+	//// main thread
+	static Timing_Window	frame_times;
+	static f64				deadline =			0;
+	static constexpr f64	MAX_SLEEP_MARGIN =	0.002; // a stall (descheduled, debugger break) must not make us spin whole frames
+	static f64				sleep_margin =		0.001; // follows the recent oversleep (the os timer resolution), jumps up and decays slowly
+	
+	// call once per frame right before sampling input
+	static void limit_frame_rate () {
+		if (fps_limit <= 0 || vsync_mode != 0) {
+			deadline = 0;
+			return;
+		}
+		
+		f64 period = 1.0 / fps_limit;
+		f64 now = glfwGetTime();
+		
+		deadline = deadline == 0 ? now +period : deadline +period;
+		if (deadline < now) deadline = now; // fell behind, do not try to catch up with shorter frames
+		
+		f64 wake = deadline -sleep_margin;
+		if (wake > now) {
+			std::this_thread::sleep_for(std::chrono::duration<f64>(wake -now));
+			
+			f64 margin = (glfwGetTime() -wake) * 1.25;
+			sleep_margin = max(margin, sleep_margin +(margin -sleep_margin) * 0.05);
+			sleep_margin = clamp(sleep_margin, 0.0, MAX_SLEEP_MARGIN);
+		}
+		
+		while (glfwGetTime() < deadline) _mm_pause();
+	}
+}
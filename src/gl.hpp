@@ -116,6 +116,7 @@ static void inplace_flip_vertical (void* data, u64 h, u64 stride) {
 }
 
 static f32				max_aniso;
+static GLint			max_array_texture_layers;
 
 enum pixel_type {
 	PT_SRGB8_LA8	=0, // srgb rgb and linear alpha
@@ -127,10 +128,17 @@ enum pixel_type {
 	PT_LRGBA32F		,
 	PT_LRGB32F		,
 	
+	PT_LRGB16F		,
+	PT_LR11G11B10F	, // packed float formats, 4 bytes per texel
+	PT_LRGB9E5		,
+	
 	PT_DXT1			,
 	PT_DXT3			,
 	PT_DXT5			,
 };
+// what .hdr files are loaded as, one of PT_LR11G11B10F, PT_LRGB9E5, PT_LRGB16F or PT_LRGB32F
+static pixel_type		hdr_pixel_type =	PT_LR11G11B10F;
+
 enum src_color_space {
 	CS_LINEAR		=0,
 	CS_SRGB			,
@@ -138,6 +146,396 @@ enum src_color_space {
 	CS_AUTO			,
 };
 
+// largest texture resolution, larger textures get downsampled by powers of two at load (the result is kept in asset_cache_path)
+//  0 means no limit, the low memory (laptop, CI) configs use 2048 which makes 4k textures a quarter of the size
+static s32				texture_max_res =	0;
+
+static iv2 get_res_cap (iv2 asset_max_res) { // combines a per asset limit with texture_max_res, components <= 0 mean no limit
+	iv2 cap = asset_max_res;
+	if (texture_max_res > 0) {
+		if (cap.x <= 0 || cap.x > texture_max_res) cap.x = texture_max_res;
+		if (cap.y <= 0 || cap.y > texture_max_res) cap.y = texture_max_res;
+	}
+	return cap;
+}
+
+// downsampled textures in asset_cache_path, so the downsampling only happens once per source file version
+namespace texture_cache {
+	static constexpr u32 VERSION = 1;
+	
+	struct Header {
+		char		magic[4];
+		u32			version;
+		u64			key;
+		pixel_type	type;
+		iv2			dim;
+		u64			stride;
+		u32			faces;
+		u64			face_size; // offset from one face to the next
+	};
+	
+	static u64 calc_key (u64 src_key, iv2 cap, src_color_space cs) {
+		u64 k = src_key;
+		k = hash_fnv1a(&cap, sizeof(cap), k);
+		k = hash_fnv1a(&cs, sizeof(cs), k);
+		k = hash_fnv1a(&hdr_pixel_type, sizeof(hdr_pixel_type), k);
+		k = hash_fnv1a(&VERSION, sizeof(VERSION), k);
+		return k;
+	}
+	
+	static str get_filepath (u64 key) {
+		return prints("%stex_%016llx.bin", asset_cache_path, key);
+	}
+	
+	static bool load (u64 key, u32 faces, Header* h, Data_Block* data) {
+		FILE* f = fopen(get_filepath(key).c_str(), "rb");
+		if (!f) return false;
+		
+		defer { fclose(f); };
+		
+		if (fread(h, 1,sizeof(*h), f) != sizeof(*h)) return false;
+		
+		if (	memcmp(h->magic, "TEX ", 4) != 0 || h->version != VERSION ||
+				h->key != key || h->faces != faces || h->dim.x <= 0 || h->dim.y <= 0) return false;
+		
+		*data = Data_Block::alloc(faces * h->face_size);
+		if (fread(data->data, 1,data->size, f) != data->size) {
+			data->free();
+			data->data = nullptr;
+			return false;
+		}
+		return true;
+	}
+	static void write (u64 key, pixel_type type, iv2 dim, u64 stride, u32 faces, u64 face_size, byte const* data, cstr name) {
+		create_asset_cache_dir();
+		
+		auto filepath = get_filepath(key);
+		
+		FILE* f = fopen(filepath.c_str(), "wb");
+		if (!f) {
+			con_logf_warning("could not write \"%s\", texture '%s' will be downsampled again next launch.", filepath.c_str(), name);
+			return;
+		}
+		
+		defer { fclose(f); };
+		
+		Header h = {};
+		memcpy(h.magic, "TEX ", 4);
+		h.version =		VERSION;
+		h.key =			key;
+		h.type =		type;
+		h.dim =			dim;
+		h.stride =		stride;
+		h.faces =		faces;
+		h.face_size =	face_size;
+		
+		fwrite(&h, 1,sizeof(h), f);
+		fwrite(data, 1,faces * face_size, f);
+	}
+}
+
+static constexpr GLint MAX_TEXTURE_UNIT = 8; // units bind_textures() manages, the rest stay unbound
+
+// Cache of the GL state we change per draw, so redundant binds and enables never reach the driver
+//  everything that binds programs, VAOs, textures or buffers or changes the Render_State goes through here, otherwise the cache gets out of sync
+//  counts the calls it issued and skipped (of the last frame in last_issued/last_skipped)
+namespace gl_state {
+	enum counter_e {
+		CNT_PROGRAM=0,
+		CNT_VAO,
+		CNT_BUFFER,
+		CNT_ACTIVE_TEXTURE,
+		CNT_TEXTURE,
+		CNT_RENDER_STATE,
+		COUNTERS
+	};
+	static u64				issued[COUNTERS] = {};
+	static u64				skipped[COUNTERS] = {};
+	static u64				last_issued =			0;
+	static u64				last_skipped =			0;
+	
+	static constexpr GLuint	UNKNOWN =				(GLuint)-1; // never a valid name, so the next bind is always issued
+	
+	enum texture_target_e { TT_2D=0, TT_2D_ARRAY, TT_CUBE_MAP, TEXTURE_TARGETS };
+	enum buffer_target_e { BT_ARRAY=0, BT_UNIFORM, BT_COPY_READ, BT_COPY_WRITE, BUFFER_TARGETS }; // not GL_ELEMENT_ARRAY_BUFFER, that is VAO state
+	static constexpr u32	UNIFORM_BINDINGS =		8;
+	
+	struct Buffer_Range {
+		GLuint		buf;
+		u64			offset;
+		u64			size;
+	};
+	
+	// fixed function state that changes between passes, applied by diff with set_render_state
+	struct Render_State {
+		bool		depth_test;
+		bool		depth_write;
+		GLenum		depth_func;
+		bool		cull_face;
+		bool		blend;
+		bool		color_write;
+	};
+	
+	static constexpr Render_State RS_OPAQUE =		{ true,		true,	GL_LEQUAL,	true,	false,	true };
+	static constexpr Render_State RS_TRANSPARENT =	{ true,		false,	GL_LESS,	true,	true,	true }; // second pass of translucent meshes
+	static constexpr Render_State RS_SKYBOX =		{ false,	true,	GL_LEQUAL,	true,	false,	true };
+	static constexpr Render_State RS_OVERLAY =		{ false,	true,	GL_LEQUAL,	false,	true,	true }; // text and overlay quads
+	static constexpr Render_State RS_DEPTH_ONLY =	{ true,		true,	GL_LEQUAL,	true,	false,	false }; // depth prepass
+	
+	static GLuint			program;
+	static GLuint			vao;
+	static GLint			active_unit;
+	static GLuint			textures[MAX_TEXTURE_UNIT][TEXTURE_TARGETS];
+	static GLuint			buffers[BUFFER_TARGETS];
+	static Buffer_Range		uniform_bindings[UNIFORM_BINDINGS];
+	static Render_State		render_state;
+	static bool				render_state_known;
+	
+	// forget everything, for after gl init or after code that changed state without us
+	static void reset () {
+		program = UNKNOWN;
+		vao = UNKNOWN;
+		active_unit = -1;
+		for (auto& u : textures) for (auto& t : u) t = UNKNOWN;
+		for (auto& b : buffers) b = UNKNOWN;
+		for (auto& b : uniform_bindings) b = { UNKNOWN, 0, 0 };
+		render_state_known = false;
+	}
+	
+	static bool skip (counter_e c, bool same) {
+		if (same)	++skipped[c];
+		else		++issued[c];
+		return same;
+	}
+	
+	static void use_program (GLuint prog) {
+		if (skip(CNT_PROGRAM, program == prog)) return;
+		glUseProgram(prog);
+		program = prog;
+	}
+	static void delete_program (GLuint prog) {
+		if (prog != 0 && program == prog) program = UNKNOWN; // stays in use until the next glUseProgram
+		glDeleteProgram(prog);
+	}
+	
+	static void bind_vertex_array (GLuint v) {
+		if (skip(CNT_VAO, vao == v)) return;
+		glBindVertexArray(v);
+		vao = v;
+	}
+	static void delete_vertex_array (GLuint v) {
+		if (v != 0 && vao == v) vao = 0; // deleting the bound VAO binds 0
+		glDeleteVertexArrays(1, &v);
+	}
+	
+	static buffer_target_e get_buffer_target (GLenum target) {
+		switch (target) {
+			case GL_ARRAY_BUFFER:		return BT_ARRAY;
+			case GL_UNIFORM_BUFFER:		return BT_UNIFORM;
+			case GL_COPY_READ_BUFFER:	return BT_COPY_READ;
+			case GL_COPY_WRITE_BUFFER:	return BT_COPY_WRITE;
+			default: dbg_assert(false); return BT_ARRAY;
+		}
+	}
+	static void bind_buffer (GLenum target, GLuint buf) {
+		auto& b = buffers[get_buffer_target(target)];
+		if (skip(CNT_BUFFER, b == buf)) return;
+		glBindBuffer(target, buf);
+		b = buf;
+	}
+	static void bind_uniform_buffer_range (GLuint index, GLuint buf, u64 offset, u64 size) {
+		dbg_assert(index < UNIFORM_BINDINGS);
+		auto& b = uniform_bindings[index];
+		if (skip(CNT_BUFFER, b.buf == buf && b.offset == offset && b.size == size)) return;
+		glBindBufferRange(GL_UNIFORM_BUFFER, index, buf, offset, size);
+		b = { buf, offset, size };
+		buffers[BT_UNIFORM] = buf; // also binds the generic binding point
+	}
+	static void bind_uniform_buffer_base (GLuint index, GLuint buf) {
+		dbg_assert(index < UNIFORM_BINDINGS);
+		glBindBufferBase(GL_UNIFORM_BUFFER, index, buf);
+		++issued[CNT_BUFFER];
+		uniform_bindings[index] = { UNKNOWN, 0, 0 }; // whole buffer, no range to compare against
+		buffers[BT_UNIFORM] = buf;
+	}
+	static void delete_buffer (GLuint buf) { // deleting unbinds it everywhere
+		if (buf == 0) return;
+		for (auto& b : buffers) if (b == buf) b = 0;
+		for (auto& b : uniform_bindings) if (b.buf == buf) b = { 0, 0, 0 };
+		glDeleteBuffers(1, &buf);
+	}
+	
+	static texture_target_e get_texture_target (GLenum target) {
+		switch (target) {
+			case GL_TEXTURE_2D:			return TT_2D;
+			case GL_TEXTURE_2D_ARRAY:	return TT_2D_ARRAY;
+			case GL_TEXTURE_CUBE_MAP:	return TT_CUBE_MAP;
+			default: dbg_assert(false); return TT_2D;
+		}
+	}
+	static void active_texture (GLint unit) {
+		if (skip(CNT_ACTIVE_TEXTURE, active_unit == unit)) return;
+		glActiveTexture(GL_TEXTURE0 +unit);
+		active_unit = unit;
+	}
+	// binds to the active unit, for uploads and parameter changes that work on the bound texture
+	static void bind_texture (GLenum target, GLuint tex) {
+		if (active_unit < 0) active_texture(0);
+		
+		auto& t = textures[active_unit][get_texture_target(target)];
+		if (skip(CNT_TEXTURE, t == tex)) return;
+		glBindTexture(target, tex);
+		t = tex;
+	}
+	// binds for sampling, only switches the active unit if the binding actually changes
+	static void bind_texture_unit (GLint unit, GLenum target, GLuint tex) {
+		dbg_assert(unit >= 0 && unit < MAX_TEXTURE_UNIT, "increase MAX_TEXTURE_UNIT (%d, tex_unit: %d)", MAX_TEXTURE_UNIT, unit);
+		
+		auto& t = textures[unit][get_texture_target(target)];
+		if (skip(CNT_TEXTURE, t == tex)) return;
+		active_texture(unit);
+		glBindTexture(target, tex);
+		t = tex;
+	}
+	static void delete_texture (GLuint tex) { // deleting unbinds it from all units
+		for (auto& u : textures) for (auto& t : u) if (t == tex) t = 0;
+		glDeleteTextures(1, &tex);
+	}
+	
+	static void set_enabled (GLenum cap, bool enable) {
+		if (enable)	glEnable(cap);
+		else		glDisable(cap);
+		++issued[CNT_RENDER_STATE];
+	}
+	static void set_render_state (Render_State const& s) {
+		auto& c = render_state;
+		bool all = !render_state_known;
+		
+		if (all || c.depth_test != s.depth_test)	set_enabled(GL_DEPTH_TEST, s.depth_test);	else ++skipped[CNT_RENDER_STATE];
+		if (all || c.depth_write != s.depth_write) {
+			glDepthMask(s.depth_write ? GL_TRUE : GL_FALSE);
+			++issued[CNT_RENDER_STATE];
+		} else {
+			++skipped[CNT_RENDER_STATE];
+		}
+		if (all || c.depth_func != s.depth_func) {
+			glDepthFunc(s.depth_func);
+			++issued[CNT_RENDER_STATE];
+		} else {
+			++skipped[CNT_RENDER_STATE];
+		}
+		if (all || c.cull_face != s.cull_face)		set_enabled(GL_CULL_FACE, s.cull_face);		else ++skipped[CNT_RENDER_STATE];
+		if (all || c.blend != s.blend)				set_enabled(GL_BLEND, s.blend);				else ++skipped[CNT_RENDER_STATE];
+		if (all || c.color_write != s.color_write) {
+			GLboolean b = s.color_write ? GL_TRUE : GL_FALSE;
+			glColorMask(b, b, b, b);
+			++issued[CNT_RENDER_STATE];
+		} else {
+			++skipped[CNT_RENDER_STATE];
+		}
+		
+		c = s;
+		render_state_known = true;
+	}
+	
+	static void end_frame () {
+		last_issued = 0;
+		last_skipped = 0;
+		for (u32 i=0; i<COUNTERS; ++i) {
+			last_issued += issued[i];
+			last_skipped += skipped[i];
+			issued[i] = 0;
+			skipped[i] = 0;
+		}
+	}
+}
+
+// Per frame counters of what the renderer asked gl to do, for spotting regressions
+//  incremented where the work is issued (draws, shader and texture binds, uniform sets that were not redundant, buffer uploads)
+//  end_frame pushes the frame into a window of the last frames, summarize gives min/avg/max over it for the overlay and benchmarks
+namespace render_stats {
+	enum stat_e {
+		ST_DRAWS=0,
+		ST_INSTANCES, // drawn by instanced draws, which count as one draw each
+		ST_TRIANGLES,
+		ST_SHADER_BINDS,
+		ST_TEXTURE_BINDS,
+		ST_UNIFORM_SETS,
+		ST_UPLOAD_BYTES, // vbos, ubos and instances, including what went through the stream buffer
+		ST_GL_CALLS, // state changes issued by gl_state
+		ST_GL_CALLS_SKIPPED,
+		STATS
+	};
+	static cstr				NAMES[STATS] = { "draws", "instances", "triangles", "shader binds", "texture binds", "uniform sets", "upload bytes", "gl calls", "gl calls skipped" };
+	
+	struct Frame {
+		u64		v[STATS];
+	};
+	struct Summary {
+		u32		frames; // in the window, 0 before the first end_frame
+		f64		min[STATS];
+		f64		avg[STATS];
+		f64		max[STATS];
+	};
+	
+	static bool					show_overlay =	false;
+	static u32					window =		120; // frames
+	
+	static Frame				cur =			{};
+	static std::vector<Frame>	history; // ring of the last window frames
+	static u32					history_next =	0;
+	static u64					frames_total =	0;
+	
+	static void add (stat_e s, u64 n=1) {
+		cur.v[s] += n;
+	}
+	static void draw (u64 triangles, u64 instances=1) {
+		cur.v[ST_DRAWS] += 1;
+		cur.v[ST_INSTANCES] += instances;
+		cur.v[ST_TRIANGLES] += triangles * instances;
+	}
+	
+	// call after gl_state::end_frame, so its counters of this frame are final
+	static void end_frame () {
+		cur.v[ST_GL_CALLS] = gl_state::last_issued;
+		cur.v[ST_GL_CALLS_SKIPPED] = gl_state::last_skipped;
+		
+		if (history.size() != window) { // window was changed
+			history.clear();
+			history_next = 0;
+		}
+		if (history.size() < window) history.push_back(cur);
+		else							history[history_next] = cur;
+		history_next = (history_next +1) % window;
+		
+		++frames_total;
+		cur = {};
+	}
+	
+	// the frame that ended last
+	static Frame get_last () {
+		if (history.size() == 0) return {};
+		return history[(history_next +(u32)history.size() -1) % (u32)history.size()];
+	}
+	static Summary summarize () {
+		Summary r = {};
+		r.frames = (u32)history.size();
+		if (r.frames == 0) return r;
+		
+		for (u32 s=0; s<STATS; ++s) {
+			r.min[s] = +INFd;
+			r.max[s] = -INFd;
+			for (auto& f : history) {
+				r.min[s] = min(r.min[s], (f64)f.v[s]);
+				r.max[s] = max(r.max[s], (f64)f.v[s]);
+				r.avg[s] += (f64)f.v[s];
+			}
+			r.avg[s] /= r.frames;
+		}
+		return r;
+	}
+}
+
 struct Texture {
 	pixel_type			type;
 	GLuint				tex;
@@ -150,7 +548,7 @@ struct Texture {
 		data.data = nullptr;
 	}
 	virtual ~Texture () {
-		glDeleteTextures(1, &tex);
+		gl_state::delete_texture(tex);
 		
 		data.free();
 	}
@@ -163,6 +561,13 @@ struct Texture {
 			case PT_LRGB8		:	return 3 * sizeof(u8);
 			case PT_LR8			:	return 1 * sizeof(u8);
 			
+			case PT_LRGBA32F	:	return 4 * sizeof(f32);
+			case PT_LRGB32F		:	return 3 * sizeof(f32);
+			
+			case PT_LRGB16F		:	return 3 * sizeof(u16);
+			case PT_LR11G11B10F	:	return sizeof(u32);
+			case PT_LRGB9E5		:	return sizeof(u32);
+			
 			case PT_DXT1		:	return 8 * sizeof(byte);
 			case PT_DXT3		:	return 16 * sizeof(byte);
 			case PT_DXT5		:	return 16 * sizeof(byte);
@@ -176,25 +581,44 @@ struct Texture {
 	
 	virtual void upload () = 0;
 	
-	virtual void bind () = 0;
+	virtual void bind (GLint tex_unit) = 0; // for sampling
+	
+	virtual u32 get_array_layer () { return 0; } // layer to sample if this texture is bound as part of a texture array
 };
 
-static constexpr GLint MAX_TEXTURE_UNIT = 8; // for debugging only, to unbind textures from unused texture units
+static bool get_gl_format (pixel_type type, GLenum* internalFormat, GLenum* format, GLenum* gl_type) { // returns if compressed
+	switch (type) {
+		case PT_SRGB8_LA8	:	*internalFormat = GL_SRGB8_ALPHA8;	*format = GL_RGBA;	*gl_type = GL_UNSIGNED_BYTE;	return false;
+		case PT_LRGBA8		:	*internalFormat = GL_RGBA8;			*format = GL_RGBA;	*gl_type = GL_UNSIGNED_BYTE;	return false;
+		case PT_SRGB8		:	*internalFormat = GL_SRGB8;			*format = GL_RGB;	*gl_type = GL_UNSIGNED_BYTE;	return false;
+		case PT_LRGB8		:	*internalFormat = GL_RGB8;			*format = GL_RGB;	*gl_type = GL_UNSIGNED_BYTE;	return false;
+		case PT_LR8			:	*internalFormat = GL_R8;			*format = GL_RED;	*gl_type = GL_UNSIGNED_BYTE;	return false;
+		
+		case PT_LRGBA32F	:	*internalFormat = GL_RGBA32F;		*format = GL_RGBA;	*gl_type = GL_FLOAT;			return false;
+		case PT_LRGB32F		:	*internalFormat = GL_RGB32F;		*format = GL_RGB;	*gl_type = GL_FLOAT;			return false;
+		
+		case PT_LRGB16F		:	*internalFormat = GL_RGB16F;		*format = GL_RGB;	*gl_type = GL_HALF_FLOAT;		return false;
+		case PT_LR11G11B10F	:	*internalFormat = GL_R11F_G11F_B10F;	*format = GL_RGB;	*gl_type = GL_UNSIGNED_INT_10F_11F_11F_REV;	return false;
+		case PT_LRGB9E5		:	*internalFormat = GL_RGB9_E5;		*format = GL_RGB;	*gl_type = GL_UNSIGNED_INT_5_9_9_9_REV;		return false;
+		
+		case PT_DXT1		:	*internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;	*format = GL_RGBA;	*gl_type = GL_UNSIGNED_BYTE;	return true; // format and type only for allocating storage without data
+		case PT_DXT3		:	*internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;	*format = GL_RGBA;	*gl_type = GL_UNSIGNED_BYTE;	return true; // format and type only for allocating storage without data
+		case PT_DXT5		:	*internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;	*format = GL_RGBA;	*gl_type = GL_UNSIGNED_BYTE;	return true; // format and type only for allocating storage without data
+		
+		default: dbg_assert(false); return false;
+	}
+}
 
 static void bind_texture_unit (GLint tex_unit, Texture* tex) {
-	dbg_assert(tex_unit >= 0 && tex_unit < MAX_TEXTURE_UNIT, "increase MAX_TEXTURE_UNIT (%d, tex_unit: %d)", MAX_TEXTURE_UNIT, tex_unit);
-	
-	glActiveTexture(GL_TEXTURE0 +tex_unit);
-	tex->bind();
+	render_stats::add(render_stats::ST_TEXTURE_BINDS);
+	tex->bind(tex_unit);
 }
-static void unbind_texture_unit (GLint tex_unit) { // just for debugging
-	dbg_assert(tex_unit >= 0 && tex_unit < MAX_TEXTURE_UNIT);
-	
-	glActiveTexture(GL_TEXTURE0 +tex_unit);
-	
-	glBindTexture(GL_TEXTURE_2D, 0); // TODO: We dont care if we bound a cubemap to this tex unit?
+static void unbind_texture_unit (GLint tex_unit) { // so unused units do not keep textures alive, free if the unit is already empty
+	gl_state::bind_texture_unit(tex_unit, GL_TEXTURE_2D, 0); // TODO: We dont care if we bound a cubemap to this tex unit?
 }
 
+struct Texture2D_Array;
+
 struct Texture2D : public Texture {
 	iv2					dim;
 	
@@ -208,8 +632,16 @@ struct Texture2D : public Texture {
 	
 	std::vector<Mip>	mips;
 	
+	// set by pack_texture_arrays(), the gpu side of this texture is then layer packed_layer of packed_array instead of tex
+	Texture2D_Array*	packed_array = nullptr;
+	u32					packed_layer = 0;
+	
+	// set by texture_streaming::init(), only the mips >= resident_mip are on the gpu
+	bool				streamed = false;
+	u32					resident_mip = 0;
+	
 	Texture2D (): Texture{} {
-		glBindTexture(GL_TEXTURE_2D, tex);
+		gl_state::bind_texture(GL_TEXTURE_2D, tex);
 	}
 	
 	void alloc_cpu_single_mip (pixel_type pt, iv2 d) {
@@ -226,25 +658,44 @@ struct Texture2D : public Texture {
 	}
 	
 	void upload () {
+		if (packed_array) {
+			upload_packed();
+			return;
+		}
+		
+		if (streamed && !can_stream()) { // was hot reloaded into something we cant stream
+			streamed = false;
+			resident_mip = 0;
+		}
+		
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 		
-		glBindTexture(GL_TEXTURE_2D, tex);
+		gl_state::bind_texture(GL_TEXTURE_2D, tex);
 		
-		switch (type) {
-			case PT_SRGB8_LA8	:	upload_uncompressed(GL_SRGB8_ALPHA8,	GL_RGBA,	GL_UNSIGNED_BYTE);	break;
-			case PT_LRGBA8		:	upload_uncompressed(GL_RGBA8,			GL_RGBA,	GL_UNSIGNED_BYTE);	break;
-			case PT_SRGB8		:	upload_uncompressed(GL_SRGB8,			GL_RGB,		GL_UNSIGNED_BYTE);	break;
-			case PT_LRGB8		:	upload_uncompressed(GL_RGB8,			GL_RGB,		GL_UNSIGNED_BYTE);	break;
-			case PT_LR8			:	upload_uncompressed(GL_R8,				GL_RED,		GL_UNSIGNED_BYTE);	break;
-			
-			case PT_LRGBA32F	:	upload_uncompressed(GL_RGBA32F,			GL_RGBA,	GL_FLOAT);	break;
-			case PT_LRGB32F		:	upload_uncompressed(GL_RGB32F,			GL_RGB,		GL_FLOAT);	break;
-			
-			case PT_DXT1		:	upload_compressed(GL_COMPRESSED_RGB_S3TC_DXT1_EXT);		break;
-			case PT_DXT3		:	upload_compressed(GL_COMPRESSED_RGBA_S3TC_DXT3_EXT);	break;
-			case PT_DXT5		:	upload_compressed(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);	break;
-			
-			default: dbg_assert(false);
+		if (streamed) {
+			resident_mip = min(resident_mip, (u32)mips.size() -1);
+			upload_resident_mips();
+		} else {
+			switch (type) {
+				case PT_SRGB8_LA8	:	upload_uncompressed(GL_SRGB8_ALPHA8,	GL_RGBA,	GL_UNSIGNED_BYTE);	break;
+				case PT_LRGBA8		:	upload_uncompressed(GL_RGBA8,			GL_RGBA,	GL_UNSIGNED_BYTE);	break;
+				case PT_SRGB8		:	upload_uncompressed(GL_SRGB8,			GL_RGB,		GL_UNSIGNED_BYTE);	break;
+				case PT_LRGB8		:	upload_uncompressed(GL_RGB8,			GL_RGB,		GL_UNSIGNED_BYTE);	break;
+				case PT_LR8			:	upload_uncompressed(GL_R8,				GL_RED,		GL_UNSIGNED_BYTE);	break;
+				
+				case PT_LRGBA32F	:	upload_uncompressed(GL_RGBA32F,			GL_RGBA,	GL_FLOAT);	break;
+				case PT_LRGB32F		:	upload_uncompressed(GL_RGB32F,			GL_RGB,		GL_FLOAT);	break;
+				
+				case PT_LRGB16F		:	upload_uncompressed(GL_RGB16F,			GL_RGB,		GL_HALF_FLOAT);	break;
+				case PT_LR11G11B10F	:	upload_uncompressed(GL_R11F_G11F_B10F,	GL_RGB,		GL_UNSIGNED_INT_10F_11F_11F_REV);	break;
+				case PT_LRGB9E5		:	upload_uncompressed(GL_RGB9_E5,			GL_RGB,		GL_UNSIGNED_INT_5_9_9_9_REV);	break;
+				
+				case PT_DXT1		:	upload_compressed(GL_COMPRESSED_RGB_S3TC_DXT1_EXT);		break;
+				case PT_DXT3		:	upload_compressed(GL_COMPRESSED_RGBA_S3TC_DXT3_EXT);	break;
+				case PT_DXT5		:	upload_compressed(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);	break;
+				
+				default: dbg_assert(false);
+			}
 		}
 		
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,		GL_LINEAR_MIPMAP_LINEAR);
@@ -252,12 +703,60 @@ struct Texture2D : public Texture {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,			GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,			GL_REPEAT);
 		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY,	max_aniso);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL,		resident_mip);
+	}
+	
+	bool can_stream () { // needs a complete mip chain to stream from
+		return !packed_array && mips.size() > 1;
+	}
+	
+	u64 get_resident_size () {
+		u64 size = 0;
+		for (u32 i=resident_mip; i<(u32)mips.size(); ++i) size += mips[i].size;
+		return size;
+	}
+	
+	void set_resident_mip (u32 mip) { // uploads or frees mips so that exactly the mips >= mip are resident
+		dbg_assert(streamed && mip < (u32)mips.size());
+		if (mip == resident_mip) return;
+		
+		GLenum internalFormat, format, gl_type;
+		bool compressed = get_gl_format(type, &internalFormat, &format, &gl_type);
+		
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		
+		gl_state::bind_texture(GL_TEXTURE_2D, tex);
+		
+		if (mip < resident_mip) {
+			for (u32 i=mip; i<resident_mip; ++i) {
+				auto& m = mips[i];
+				
+				if (compressed)	glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat, m.dim.x,m.dim.y, 0, m.size, m.data);
+				else			glTexImage2D(GL_TEXTURE_2D, i, internalFormat, m.dim.x,m.dim.y, 0, format, gl_type, m.data);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, mip);
+		} else {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, mip); // before freeing, so the texture never references a freed mip
+			
+			for (u32 i=resident_mip; i<mip; ++i) {
+				glTexImage2D(GL_TEXTURE_2D, i, internalFormat, 0,0, 0, format, gl_type, NULL); // zero sized image frees the mip
+			}
+		}
+		
+		resident_mip = mip;
 	}
 	
-	virtual void bind () {
-		glBindTexture(GL_TEXTURE_2D, tex);
+	virtual void bind (GLint tex_unit) {
+		if (packed_array) {
+			bind_packed(tex_unit);
+			return;
+		}
+		
+		gl_state::bind_texture_unit(tex_unit, GL_TEXTURE_2D, tex);
 	}
 	
+	virtual u32 get_array_layer () { return packed_layer; }
+	
 	void flip_vertical () {
 		dbg_assert(type == PT_LR8);
 		dbg_assert(mips.size() == 1);
@@ -270,6 +769,23 @@ struct Texture2D : public Texture {
 	virtual bool reload_if_needed () { return false; }
 	
 private:
+	void upload_packed ();
+	void bind_packed (GLint tex_unit);
+	
+	void upload_resident_mips () {
+		GLenum internalFormat, format, gl_type;
+		bool compressed = get_gl_format(type, &internalFormat, &format, &gl_type);
+		
+		for (u32 i=0; i<(u32)mips.size(); ++i) {
+			auto& m = mips[i];
+			
+			if (i < resident_mip)	glTexImage2D(GL_TEXTURE_2D, i, internalFormat, 0,0, 0, format, gl_type, NULL); // free mips left over from before a reload
+			else if (compressed)	glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat, m.dim.x,m.dim.y, 0, m.size, m.data);
+			else					glTexImage2D(GL_TEXTURE_2D, i, internalFormat, m.dim.x,m.dim.y, 0, format, gl_type, m.data);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)mips.size() -1);
+	}
+	
 	void upload_compressed (GLenum internalFormat) {
 		dbg_assert((u32)mips.size() >= 1);
 		
@@ -321,6 +837,128 @@ private:
 	
 };
 
+// Same format, same size (and same mip count) Texture2Ds stored as the layers of one GL_TEXTURE_2D_ARRAY
+//  filled by pack_texture_arrays(), the Texture2Ds keep their cpu data and upload into their layer when they get reloaded
+struct Texture2D_Array : public Texture {
+	iv2							dim;
+	u32							mip_count;
+	
+	std::vector<Texture2D*>		layers;
+	
+	Texture2D_Array (): Texture{} {
+		gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, tex);
+	}
+	
+	bool can_hold (Texture2D* t) {
+		if (layers.size() == 0) return true;
+		if ((s32)layers.size() >= max_array_texture_layers) return false;
+		
+		return t->type == type && all(t->dim == dim) && (u32)t->mips.size() == mip_count;
+	}
+	void add_layer (Texture2D* t) {
+		dbg_assert(can_hold(t));
+		
+		if (layers.size() == 0) {
+			type = t->type;
+			dim = t->dim;
+			mip_count = (u32)t->mips.size();
+		}
+		
+		t->packed_array = this;
+		t->packed_layer = (u32)layers.size();
+		layers.push_back(t);
+	}
+	
+	virtual void upload () { // allocates all mips of all layers and uploads every layer
+		dbg_assert(layers.size() >= 1);
+		
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		
+		gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, tex);
+		
+		GLenum internalFormat, format, gl_type;
+		bool compressed = get_gl_format(type, &internalFormat, &format, &gl_type);
+		
+		auto* l0 = layers[0];
+		for (u32 mip_i=0; mip_i<mip_count; ++mip_i) {
+			auto& m = l0->mips[mip_i];
+			
+			if (compressed)	glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, mip_i, internalFormat, m.dim.x,m.dim.y,(GLsizei)layers.size(), 0, (GLsizei)(m.size * layers.size()), NULL);
+			else			glTexImage3D(GL_TEXTURE_2D_ARRAY, mip_i, internalFormat, m.dim.x,m.dim.y,(GLsizei)layers.size(), 0, format, gl_type, NULL);
+		}
+		
+		for (u32 i=0; i<(u32)layers.size(); ++i) {
+			upload_layer_mips(i, compressed, internalFormat, format, gl_type);
+		}
+		
+		if (needs_generated_mips()) glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,		GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER,		GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S,			GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T,			GL_REPEAT);
+		glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY,	max_aniso);
+	}
+	
+	void upload_layer (u32 layer) { // reupload of a single reloaded layer
+		dbg_assert(layer < (u32)layers.size());
+		
+		auto* t = layers[layer];
+		if (t->type != type || !all(t->dim == dim) || (u32)t->mips.size() != mip_count) {
+			con_logf_warning("reloaded texture does not match the format or size of its texture array anymore, not uploaded!");
+			return;
+		}
+		
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		
+		gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, tex);
+		
+		GLenum internalFormat, format, gl_type;
+		bool compressed = get_gl_format(type, &internalFormat, &format, &gl_type);
+		
+		upload_layer_mips(layer, compressed, internalFormat, format, gl_type);
+		
+		if (needs_generated_mips()) glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	}
+	
+	virtual void bind (GLint tex_unit) {
+		gl_state::bind_texture_unit(tex_unit, GL_TEXTURE_2D_ARRAY, tex);
+	}
+	
+	virtual bool load () { dbg_assert(false); return false; }
+	virtual bool reload_if_needed () { return false; }
+	
+private:
+	bool needs_generated_mips () { // same rule as Texture2D: either a full mip chain or only mip 0
+		u32 full_chain = 1;
+		for (s32 w=dim.x, h=dim.y; w > 1 || h > 1; w = max(w/2, 1), h = max(h/2, 1)) ++full_chain;
+		
+		if (mip_count == full_chain) return false;
+		
+		dbg_assert(mip_count == 1, "%u %u", mip_count, full_chain);
+		return true;
+	}
+	
+	void upload_layer_mips (u32 layer, bool compressed, GLenum internalFormat, GLenum format, GLenum gl_type) {
+		auto* t = layers[layer];
+		
+		for (u32 mip_i=0; mip_i<mip_count; ++mip_i) {
+			auto& m = t->mips[mip_i];
+			
+			if (compressed)	glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip_i, 0,0,layer, m.dim.x,m.dim.y,1, internalFormat, (GLsizei)m.size, m.data);
+			else			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip_i, 0,0,layer, m.dim.x,m.dim.y,1, format, gl_type, m.data);
+		}
+	}
+	
+};
+
+void Texture2D::upload_packed () {
+	packed_array->upload_layer(packed_layer);
+}
+void Texture2D::bind_packed (GLint tex_unit) {
+	packed_array->bind(tex_unit);
+}
+
 struct TextureCube : public Texture {
 	iv2					dim;
 	
@@ -330,20 +968,20 @@ struct TextureCube : public Texture {
 		
 		iv2		dim;
 		u64		stride;
-		u64		face_size;
+		u64		face_size; // offset from one face to the next, can include padding
 	};
 	
 	std::vector<Mip>	mips;
 	
 	TextureCube (): Texture{} {
-		glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+		gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, tex);
 	}
 	
 	void alloc_gpu_single_mip (pixel_type pt, iv2 d) {
 		type = pt;
 		dim = d;
 		
-		glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+		gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, tex);
 		
 		switch (type) {
 			case PT_SRGB8_LA8	:	alloc_uncompressed(GL_SRGB8_ALPHA8,	GL_RGBA,	GL_UNSIGNED_BYTE);	break;
@@ -355,6 +993,10 @@ struct TextureCube : public Texture {
 			case PT_LRGBA32F	:	alloc_uncompressed(GL_RGBA32F,		GL_RGBA,	GL_FLOAT);	break;
 			case PT_LRGB32F		:	alloc_uncompressed(GL_RGB32F,		GL_RGB,		GL_FLOAT);	break;
 			
+			case PT_LRGB16F		:	alloc_uncompressed(GL_RGB16F,		GL_RGB,		GL_HALF_FLOAT);	break;
+			case PT_LR11G11B10F	:	alloc_uncompressed(GL_R11F_G11F_B10F,	GL_RGB,		GL_UNSIGNED_INT_10F_11F_11F_REV);	break;
+			case PT_LRGB9E5		:	alloc_uncompressed(GL_RGB9_E5,		GL_RGB,		GL_UNSIGNED_INT_5_9_9_9_REV);	break;
+			
 			case PT_DXT1		:	alloc_compressed(GL_COMPRESSED_RGB_S3TC_DXT1_EXT);	break;
 			case PT_DXT3		:	alloc_compressed(GL_COMPRESSED_RGBA_S3TC_DXT3_EXT);	break;
 			case PT_DXT5		:	alloc_compressed(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);	break;
@@ -366,7 +1008,7 @@ struct TextureCube : public Texture {
 	virtual void upload () {
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 		
-		glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+		gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, tex);
 		
 		switch (type) {
 			case PT_SRGB8_LA8	:	upload_uncompressed(GL_SRGB8_ALPHA8,	GL_RGBA,	GL_UNSIGNED_BYTE);	break;
@@ -375,6 +1017,13 @@ struct TextureCube : public Texture {
 			case PT_LRGB8		:	upload_uncompressed(GL_RGB8,			GL_RGB,		GL_UNSIGNED_BYTE);	break;
 			case PT_LR8			:	upload_uncompressed(GL_R8,				GL_RED,		GL_UNSIGNED_BYTE);	break;
 			
+			case PT_LRGBA32F	:	upload_uncompressed(GL_RGBA32F,			GL_RGBA,	GL_FLOAT);	break;
+			case PT_LRGB32F		:	upload_uncompressed(GL_RGB32F,			GL_RGB,		GL_FLOAT);	break;
+			
+			case PT_LRGB16F		:	upload_uncompressed(GL_RGB16F,			GL_RGB,		GL_HALF_FLOAT);	break;
+			case PT_LR11G11B10F	:	upload_uncompressed(GL_R11F_G11F_B10F,	GL_RGB,		GL_UNSIGNED_INT_10F_11F_11F_REV);	break;
+			case PT_LRGB9E5		:	upload_uncompressed(GL_RGB9_E5,			GL_RGB,		GL_UNSIGNED_INT_5_9_9_9_REV);	break;
+			
 			case PT_DXT1		:	upload_compressed(GL_COMPRESSED_RGB_S3TC_DXT1_EXT);		break;
 			case PT_DXT3		:	upload_compressed(GL_COMPRESSED_RGBA_S3TC_DXT3_EXT);	break;
 			case PT_DXT5		:	upload_compressed(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);	break;
@@ -382,7 +1031,7 @@ struct TextureCube : public Texture {
 			default: dbg_assert(false);
 		}
 		
-		glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+		gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, tex);
 		
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,		GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER,		GL_LINEAR);
@@ -392,13 +1041,18 @@ struct TextureCube : public Texture {
 		glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_ANISOTROPY,	max_aniso);
 	}
 	
-	virtual void bind () {
-		glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+	virtual void bind (GLint tex_unit) {
+		gl_state::bind_texture_unit(tex_unit, GL_TEXTURE_CUBE_MAP, tex);
 	}
 	
 	virtual bool load () { dbg_assert(false); return false; }
 	virtual bool reload_if_needed () { return false; }
 	
+	// for cubemaps that are loaded from a equirectangular image, the cpu-side data lives in that image instead of mips
+	virtual Texture2D* get_equirect () { return nullptr; }
+	// identifies the current version of the source data (0 if not loaded from files)
+	virtual u64 get_source_key () { return 0; }
+	
 private:
 	void upload_compressed (GLenum internalFormat) {
 		dbg_assert(false, "not implemented");
@@ -451,7 +1105,9 @@ struct File_Texture2D : public Texture2D {
 	Source_File		srcf;
 	src_color_space	cs;
 	
-	File_Texture2D (src_color_space cs_, strcr fn): Texture2D{}, filename{fn}, cs{cs_} {
+	iv2				max_res; // resolution cap of this texture (see get_res_cap), 0 for only texture_max_res
+	
+	File_Texture2D (src_color_space cs_, strcr fn, iv2 max_res_=0): Texture2D{}, filename{fn}, cs{cs_}, max_res{max_res_} {
 		auto filepath = prints("%s/%s", textures_base_path, filename.c_str());
 		
 		srcf.init(filepath);
@@ -480,7 +1136,7 @@ struct File_Texture2D : public Texture2D {
 		
 		if (1) {
 			auto dt = glfwGetTime() -begin;
-			con_logf(">>> %f ms", dt * 1000);
+			con_logf(">>> %f ms (%.0f MB/s decoded)", dt * 1000, (f64)data.size / (1024*1024) / dt);
 		}
 		
 		return true;
@@ -504,13 +1160,80 @@ private:
 		str ext;
 		get_fileext(srcf.filepath, &ext);
 		
-		if (		ext.compare("dds") == 0 ) {
-			return load_dds(srcf.filepath, cs, &type, &dim, &mips, &data);
-		} else if (	ext.compare("hdr") == 0 ) {
-			return load_img_stb_f32(srcf.filepath, cs, &type, &dim, &mips, &data);
+		iv2 cap = get_res_cap(max_res);
+		
+		if (ext.compare("dds") == 0) {
+			if (!load_dds(srcf.filepath, cs, &type, &dim, &mips, &data)) return false;
+			
+			drop_mips_over_cap(cap);
+			return true;
+		}
+		
+		bool capped = cap.x > 0 || cap.y > 0;
+		u64 cache_key = capped ? texture_cache::calc_key(srcf.get_change_key(), cap, cs) : 0;
+		
+		if (capped && load_cached(cache_key)) return true;
+		
+		u32 levels;
+		if (ext.compare("hdr") == 0) {
+			if (!load_img_hdr(srcf.filepath, cs, cap, &type, &dim, &mips, &data, &levels)) return false;
 		} else {
-			return load_img_stb(srcf.filepath, cs, &type, &dim, &mips, &data);
+			if (!load_img_stb(srcf.filepath, cs, &type, &dim, &mips, &data)) return false;
+			
+			levels = downsample::get_levels(dim, cap);
+			if (levels > 0) downsample_u8(levels);
+		}
+		
+		if (levels > 0) {
+			con_logf("downsampled '%s' to %dx%d", filename.c_str(), dim.x, dim.y);
+			texture_cache::write(cache_key, type, dim, mips[0].stride, 1, data.size, data.data, filename.c_str());
+		}
+		return true;
+	}
+	
+	bool load_cached (u64 key) {
+		texture_cache::Header h;
+		if (!texture_cache::load(key, 1, &h, &data)) return false;
+		
+		type = h.type;
+		dim = h.dim;
+		
+		mips.resize(1);
+		mips[0] = { data.data, data.size, dim, h.stride };
+		return true;
+	}
+	
+	void downsample_u8 (u32 levels) {
+		dbg_assert(mips.size() == 1);
+		
+		u32 channels = (u32)(mips[0].stride / dim.x);
+		bool srgb = type == PT_SRGB8 || type == PT_SRGB8_LA8;
+		
+		iv2 new_dim = downsample::get_dim(dim, levels);
+		u64 stride = (u64)new_dim.x * channels;
+		
+		auto new_data = Data_Block::alloc((u64)new_dim.y * stride);
+		downsample::image_u8(data.data, dim, mips[0].stride, channels, srgb, levels, new_data.data, stride);
+		
+		data.free();
+		data = new_data;
+		dim = new_dim;
+		
+		mips[0] = { data.data, data.size, dim, stride };
+	}
+	
+	// compressed textures can not be downsampled, but we can start at a smaller mip if the file has them
+	void drop_mips_over_cap (iv2 cap) {
+		u32 first = 0;
+		while (first +1 < (u32)mips.size() && downsample::get_levels(mips[first].dim, cap) > 0) ++first;
+		
+		if (downsample::get_levels(mips[first].dim, cap) > 0) {
+			con_logf_warning("\"%s\" is larger than the resolution cap but has no mips that fit, using it as is", filename.c_str());
 		}
+		if (first == 0) return;
+		
+		mips.erase(mips.begin(), mips.begin() +first);
+		dim = mips[0].dim;
 	}
 	
 	static bool load_dds (strcr filepath, src_color_space cs, pixel_type* type, iv2* dim, std::vector<Mip>* mips, Data_Block* data) {
@@ -624,11 +1347,20 @@ private:
 		return true;
 	}
 	static bool load_img_stb (strcr filepath, src_color_space cs, pixel_type* type, iv2* dim, std::vector<Mip>* mips, Data_Block* data) {
-		stbi_set_flip_vertically_on_load(true); // OpenGL has textues bottom-up
+		str ext;
+		get_fileext(filepath, &ext);
 		
 		int n;
-		data->data = stbi_load(filepath.c_str(), &dim->x, &dim->y, &n, 0);
-		if (!data->data) return false;
+		data->data = nullptr;
+		if (ext.compare("png") == 0)
+			data->data = png::load(filepath.c_str(), &dim->x, &dim->y, &n); // faster, falls back to stb for the pngs it does not support
+		
+		if (!data->data) {
+			stbi_set_flip_vertically_on_load(true); // OpenGL has textues bottom-up
+			
+			data->data = stbi_load(filepath.c_str(), &dim->x, &dim->y, &n, 0);
+			if (!data->data) return false;
+		}
 		
 		switch (n) {
 			case 4: {
@@ -656,31 +1388,23 @@ private:
 		
 		return true;
 	}
-	static bool load_img_stb_f32 (strcr filepath, src_color_space cs, pixel_type* type, iv2* dim, std::vector<Mip>* mips, Data_Block* data) {
-		stbi_set_flip_vertically_on_load(true); // OpenGL has textues bottom-up
-		
-		int n;
-		data->data = (byte*)stbi_loadf(filepath.c_str(), &dim->x, &dim->y, &n, 0);
-		if (!data->data) return false;
+	static bool load_img_hdr (strcr filepath, src_color_space cs, iv2 cap, pixel_type* type, iv2* dim, std::vector<Mip>* mips, Data_Block* data, u32* levels) {
+		dbg_assert(cs == CS_LINEAR || cs == CS_AUTO);
 		
-		switch (n) {
-			case 4: {
-				switch (cs) {
-					case CS_LINEAR: case CS_AUTO:	*type = PT_LRGBA32F;	break;
-					default: dbg_assert(false);
-				}
-			} break;
-			case 3: {
-				switch (cs) {
-					case CS_LINEAR: case CS_AUTO:	*type = PT_LRGB32F;		break;
-					default: dbg_assert(false);
-				}
-			} break;
-			default: dbg_assert(false);
+		hdr::format_e format;
+		switch (hdr_pixel_type) {
+			case PT_LRGB9E5		:	format = hdr::RGB9E5;		break;
+			case PT_LR11G11B10F	:	format = hdr::R11G11B10F;	break;
+			case PT_LRGB16F		:	format = hdr::RGB16F;		break;
+			case PT_LRGB32F		:	format = hdr::RGB32F;		break;
+			default: dbg_assert(false); return false;
 		}
 		
-		u64 stride = dim->x * n * sizeof(f32);
-		data->size = dim->y * stride;
+		if (!hdr::load(filepath.c_str(), format, cap, dim, data, levels)) return false;
+		
+		*type = hdr_pixel_type;
+		
+		u64 stride = (u64)dim->x * hdr::get_texel_size(format);
 		
 		mips->resize(1);
 		(*mips)[0] = { data->data, data->size, *dim, stride };
@@ -756,7 +1480,7 @@ struct File_TextureCube : public TextureCube {
 		if (!equirect) {
 			TextureCube::upload();
 		} else {
-			type = equirect->type;
+			type = equirect->type == PT_LRGB9E5 ? PT_LR11G11B10F : equirect->type; // rgb9_e5 is not color renderable
 			dim = (s32)round_up_to_pot((u32)max(equirect->dim.x, equirect->dim.y) / 4);
 			
 			equirect->upload();
@@ -765,11 +1489,13 @@ struct File_TextureCube : public TextureCube {
 			
 			gpu_convert_equirectangular_to_cubemap();
 			
-			glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+			gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, tex);
 			
 			glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 		}
 	}
+	virtual Texture2D* get_equirect () { return equirect; }
+	virtual u64 get_source_key () { return srcf.get_change_key(); }
 	
 private:
 	bool load_texture () {
@@ -783,7 +1509,7 @@ private:
 			// we are loading a cubemap from a equirectangular 2d image
 			
 			delete equirect;
-			equirect = new File_Texture2D(cs, filename);
+			equirect = new File_Texture2D(cs, filename, equirect_max_res); // downsampled before the conversion, the cubemap res follows from the equirect res
 			
 			return equirect->load();
 		}
@@ -831,7 +1557,7 @@ struct Multi_File_TextureCube : public TextureCube { // Cubemap with one image f
 		
 		if (1) {
 			auto dt = glfwGetTime() -begin;
-			con_logf(">>> %f ms", dt * 1000);
+			con_logf(">>> %f ms (%.0f MB/s decoded)", dt * 1000, (f64)data.size / (1024*1024) / dt);
 		}
 		
 		return true;
@@ -850,6 +1576,8 @@ struct Multi_File_TextureCube : public TextureCube { // Cubemap with one image f
 		return reloaded;
 	}
 	
+	virtual u64 get_source_key () { return srcf.get_change_key(); }
+	
 private:
 	bool load_textures () {
 		for (ui i=0; i<6; ++i) {
@@ -861,43 +1589,92 @@ private:
 				return false;
 			}
 		}
-		return load_cubemap_faces_stb(srcf, cs, &type, &dim, &mips, &data);
+		
+		iv2 cap = get_res_cap(0);
+		bool capped = cap.x > 0 || cap.y > 0;
+		u64 cache_key = capped ? texture_cache::calc_key(srcf.get_change_key(), cap, cs) : 0;
+		
+		if (capped) {
+			texture_cache::Header h;
+			if (texture_cache::load(cache_key, 6, &h, &data)) {
+				type = h.type;
+				dim = h.dim;
+				
+				mips.resize(1);
+				mips[0] = { data.data, data.size, dim, h.stride, h.face_size };
+				return true;
+			}
+		}
+		
+		if (!load_cubemap_faces_stb(srcf, cs, &type, &dim, &mips, &data)) return false;
+		
+		u32 levels = downsample::get_levels(dim, cap);
+		if (levels > 0) {
+			downsample_faces(levels);
+			
+			con_logf("downsampled '%s' to %dx%d", filename.c_str(), dim.x, dim.y);
+			texture_cache::write(cache_key, type, dim, mips[0].stride, 6, mips[0].face_size, data.data, filename.c_str());
+		}
+		return true;
 	}
 	
-	static bool load_cubemap_faces_stb (Source_Files const& filespath, src_color_space cs, pixel_type* type, iv2* dim, std::vector<Mip>* mips, Data_Block* data) {
-		stbi_set_flip_vertically_on_load(true); // OpenGL has textues bottom-up
+	void downsample_faces (u32 levels) {
+		auto& m = mips[0];
 		
-		int n;
+		u32 channels = (u32)(m.stride / dim.x);
+		bool srgb = type == PT_SRGB8 || type == PT_SRGB8_LA8;
+		
+		iv2 new_dim = downsample::get_dim(dim, levels);
+		u64 stride = (u64)new_dim.x * channels;
+		u64 face_size = ((u64)new_dim.y * stride +63) & ~(u64)63;
+		
+		auto new_data = Data_Block::alloc(6 * face_size);
+		for (u32 i=0; i<6; ++i) {
+			downsample::image_u8(data.data +i * m.face_size, dim, m.stride, channels, srgb, levels, new_data.data +i * face_size, stride);
+		}
 		
-		byte* data_cur;
+		data.free();
+		data = new_data;
+		dim = new_dim;
 		
-		u64 stride;
-		u64 face_size;
+		m = { data.data, data.size, dim, stride, face_size };
+	}
+	
+	static bool load_cubemap_faces_stb (Source_Files const& filespath, src_color_space cs, pixel_type* type, iv2* dim, std::vector<Mip>* mips, Data_Block* data) {
+		stbi_set_flip_vertically_on_load(true); // OpenGL has textues bottom-up
 		
+		// probe the headers first so the faces can be validated and decoded in parallel into one buffer
+		int n;
 		for (ui i=0; i<6; ++i) {
 			int face_n;
 			iv2 face_dim;
 			
-			byte* face_data = stbi_load(filespath.v[i].filepath.c_str(), &face_dim.x, &face_dim.y, &face_n, 0);
-			if (!face_data) return false;
+			if (!stbi_info(filespath.v[i].filepath.c_str(), &face_dim.x, &face_dim.y, &face_n)) return false;
 			
 			if (i == 0) {
 				n = face_n;
 				*dim = face_dim;
-				
-				stride = (u64)dim->x * (u64)n;
-				face_size = (u64)dim->y * stride;
-				
-				*data = Data_Block::alloc(6 * face_size);
-				data_cur = data->data;
-			} else {
-				if (face_n != n || any(face_dim != *dim)) return false;
+			} else if (face_n != n || any(face_dim != *dim)) {
+				con_logf_warning("cubemap faces differ in size or channel count");
+				return false;
 			}
-			
-			memcpy(data_cur, face_data, face_size);
-			data_cur += face_size;
-			
-			free(face_data);
+		}
+		
+		u64 stride = (u64)dim->x * (u64)n;
+		u64 image_size = (u64)dim->y * stride;
+		u64 face_size = (image_size +1 +63) & ~(u64)63; // +1 since stb can write one byte past the image (jpeg), 64 byte aligned faces
+		
+		*data = Data_Block::alloc(6 * face_size);
+		
+		std::atomic<u32> failed (0);
+		parallel_for(6, [&] (u32 i) {
+			if (!stbi_load_into(filespath.v[i].filepath.c_str(), *dim, n, data->data +i * face_size, image_size)) failed++;
+		});
+		
+		if (failed != 0) {
+			data->free();
+			data->data = nullptr;
+			return false;
 		}
 		
 		switch (n) {
@@ -941,250 +1718,1058 @@ enum data_type {
 	T_M4		,
 };
 
+static bool get_data_type (GLenum gl_type, data_type* type) { // false for types we dont set through Uniform (samplers, bools, ...)
+	switch (gl_type) {
+		case GL_FLOAT:			*type = T_FLT;	return true;
+		case GL_FLOAT_VEC2:		*type = T_V2;	return true;
+		case GL_FLOAT_VEC3:		*type = T_V3;	return true;
+		case GL_FLOAT_VEC4:		*type = T_V4;	return true;
+		case GL_INT:			*type = T_INT;	return true;
+		case GL_INT_VEC2:		*type = T_IV2;	return true;
+		case GL_INT_VEC3:		*type = T_IV3;	return true;
+		case GL_INT_VEC4:		*type = T_IV4;	return true;
+		case GL_FLOAT_MAT3:		*type = T_M3;	return true;
+		case GL_FLOAT_MAT4:		*type = T_M4;	return true;
+		default:								return false;
+	}
+}
+
+// identifies a uniform by the hash of its name, the constexpr constructor lets the compiler hash string literals at compile time
+struct Uniform_Id {
+	u32			hash;
+	cstr		name;
+	
+	constexpr Uniform_Id (cstr n): hash{hash_fnv1a_32(n)}, name{n} {}
+};
+
 struct Uniform {
+	str			name;
+	u32			hash;
 	GLint		loc;
 	data_type	type;
-	cstr		name;
 	
-	Uniform (data_type t, cstr n): type{t}, name{n} {}
+	// last value set, so setting the same value again (like the camera matrices for every mesh) skips the glUniform call
+	//  uniform values are per program, so this stays valid until the program is relinked
+	alignas(16) byte	shadow[sizeof(m4)];
+	bool				shadow_valid;
+	
+	Uniform (data_type t, strcr n, GLint l): name{n}, hash{hash_fnv1a_32(n.c_str())}, loc{l}, type{t}, shadow_valid{false} {}
+	
+	template <typename T>
+	bool changed (T const& v) {
+		static_assert(sizeof(T) <= sizeof(shadow), "");
+		if (shadow_valid && memcmp(shadow, &v, sizeof(T)) == 0) return false;
+		
+		memcpy(shadow, &v, sizeof(T));
+		shadow_valid = true;
+		render_stats::add(render_stats::ST_UNIFORM_SETS); // every caller sets the uniform when this returns true
+		return true;
+	}
 	
 	void set (f32 v) {
-		dbg_assert(type == T_FLT, "%s", name);
-		glUniform1fv(loc, 1, &v);
+		dbg_assert(type == T_FLT, "%s", name.c_str());
+		if (changed(v)) glUniform1fv(loc, 1, &v);
 	}
 	void set (v2 v) {
-		dbg_assert(type == T_V2, "%s", name);
-		glUniform2fv(loc, 1, &v.x);
+		dbg_assert(type == T_V2, "%s", name.c_str());
+		if (changed(v)) glUniform2fv(loc, 1, &v.x);
 	}
 	void set (v3 v) {
-		dbg_assert(type == T_V3, "%s", name);
-		glUniform3fv(loc, 1, &v.x);
+		dbg_assert(type == T_V3, "%s", name.c_str());
+		if (changed(v)) glUniform3fv(loc, 1, &v.x);
 	}
 	void set (v4 v) {
-		dbg_assert(type == T_V4, "%s", name);
-		glUniform4fv(loc, 1, &v.x);
+		dbg_assert(type == T_V4, "%s", name.c_str());
+		if (changed(v)) glUniform4fv(loc, 1, &v.x);
 	}
 	void set (iv2 v) {
-		dbg_assert(type == T_IV2, "%s", name);
-		glUniform2iv(loc, 1, &v.x);
+		dbg_assert(type == T_IV2, "%s", name.c_str());
+		if (changed(v)) glUniform2iv(loc, 1, &v.x);
 	}
 	void set (m3 v) {
-		dbg_assert(type == T_M3, "%s", name);
-		glUniformMatrix3fv(loc, 1, GL_FALSE, &v.arr[0][0]);
+		dbg_assert(type == T_M3, "%s", name.c_str());
+		if (changed(v)) glUniformMatrix3fv(loc, 1, GL_FALSE, &v.arr[0][0]);
 	}
 	void set (m4 v) {
-		dbg_assert(type == T_M4, "%s", name);
-		glUniformMatrix4fv(loc, 1, GL_FALSE, &v.arr[0][0]);
+		dbg_assert(type == T_M4, "%s", name.c_str());
+		if (changed(v)) glUniformMatrix4fv(loc, 1, GL_FALSE, &v.arr[0][0]);
+	}
+	
+	// uniform arrays, these do not fit the shadow so they are always set
+	void set (v3 const* arr, u32 count) {
+		dbg_assert(type == T_V3, "%s", name.c_str());
+		shadow_valid = false;
+		render_stats::add(render_stats::ST_UNIFORM_SETS);
+		glUniform3fv(loc, (GLsizei)count, &arr[0].x);
 	}
 };
 
-struct Shader {
-	str								vert_filename;
-	str								frag_filename;
+// fixed vertex attribute locations, every attribute name used by a Vertex_Layout gets its own location
+//  they are bound with glBindAttribLocation before linking, so the VAO of a Vbo works with every shader without querying locations
+namespace attrib_locations {
+	static std::vector<cstr>& get_names () { // function static, since the layouts register their names during static init
+		static std::vector<cstr> names;
+		return names;
+	}
+	
+	// registers name if it is new, matrix attributes take one location per column (slots), the following ones are nullptr in names
+	static GLuint get (cstr name, u32 slots=1) {
+		auto& names = get_names();
+		for (u32 i=0; i<(u32)names.size(); ++i) {
+			if (names[i] && strcmp(names[i], name) == 0) return (GLuint)i;
+		}
+		
+		GLuint loc = (GLuint)names.size();
+		names.push_back(name);
+		for (u32 i=1; i<slots; ++i) names.push_back(nullptr);
+		
+		dbg_assert(names.size() <= 16, "more attribute locations than GL_MAX_VERTEX_ATTRIBS is guaranteed to be");
+		return loc;
+	}
 	
-	Source_Files					srcf;
+	static void bind (GLuint prog) { // before linking
+		auto& names = get_names();
+		for (u32 i=0; i<(u32)names.size(); ++i) {
+			if (names[i]) glBindAttribLocation(prog, (GLuint)i, names[i]);
+		}
+	}
 	
-	str								vert_src;
-	str								frag_src;
+	static u64 hash (u64 h) { // the locations end up in program binaries
+		for (auto* n : get_names()) h = n ? hash_fnv1a(n, strlen(n) +1, h) : hash_fnv1a("", 1, h);
+		return h;
+	}
 	
-	struct Uniform_Texture {
-		GLint			tex_unit;
-		GLint			loc;
-		cstr			name;
+	// after linking, an attribute no layout knows would get a location from the driver that might alias one of ours
+	static void check_program (GLuint prog, strcr vert_filename) {
+		GLint count = 0;
+		GLint max_len = 0;
+		glGetProgramiv(prog, GL_ACTIVE_ATTRIBUTES, &count);
+		glGetProgramiv(prog, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_len);
 		
-		Uniform_Texture (GLint unit, cstr n): tex_unit{unit}, name{n} {}
-	};
-	
-	GLuint							prog;
+		str name_buf;
+		name_buf.resize(max(max_len, 1));
+		
+		auto& names = get_names();
+		for (GLint i=0; i<count; ++i) {
+			GLsizei len = 0;
+			GLint size;
+			GLenum type;
+			glGetActiveAttrib(prog, (GLuint)i, (GLsizei)name_buf.size(), &len, &size, &type, &name_buf[0]);
+			
+			str name (name_buf.data(), len);
+			if (name.compare(0, 3, "gl_") == 0) continue; // gl_VertexID etc.
+			
+			GLint loc = glGetAttribLocation(prog, name.c_str());
+			if (loc < 0 || loc >= (GLint)names.size() || !names[loc] || name.compare(names[loc]) != 0) {
+				con_logf_warning("Vertex attribute \"%s\" in \"%s\" is not part of any Vertex_Layout, it will not get any data!", name.c_str(), vert_filename.c_str());
+			}
+		}
+	}
+}
+
+// Ring buffer for data that is rewritten every frame (streamed vertices, the per frame uniform blocks)
+//  split into one part per frame in flight, the fence of a part tells us when the gpu is done reading it,
+//  so we can write into it without the driver having to orphan and reallocate a buffer for every upload
+//  persistently mapped with ARB_buffer_storage, otherwise each write maps its range unsynchronized
+namespace stream_buffer {
+	static bool				enable =			true;
+	static u64				frame_size =		(u64)4 *1024*1024; // bytes per frame in flight, writes that do not fit fall back to the callers own buffers
 	
-	std::vector<Uniform>			uniforms;
-	std::vector<Uniform_Texture>	textures;
+	static constexpr u32	FRAMES_IN_FLIGHT =	3;
 	
-	Shader (strcr v, strcr f, std::vector<Uniform> const& u, std::vector<Uniform_Texture> const& t):
-			vert_filename{v}, frag_filename{f}, prog{0}, uniforms{u}, textures{t} {}
+	static GLuint			buf =				0;
+	static byte*			mapped =			nullptr; // persistent mapping of the whole buffer
+	static GLsync			fences[FRAMES_IN_FLIGHT] = {};
 	
-	~Shader () {
-		unload_program();
-		srcf.close_all();
-	}
+	static u32				cur_part =			0; // part written this frame
+	static u64				used =				0; // bytes of cur_part
 	
-	bool valid () {
-		return prog != 0;
+	static void init () { // after gl init
+		if (!enable) return;
+		
+		u64 size = frame_size * FRAMES_IN_FLIGHT;
+		
+		glGenBuffers(1, &buf);
+		gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, buf); // a target that is not part of any VAO
+		
+		if (GLAD_GL_ARB_buffer_storage) {
+			GLbitfield flags = GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+			
+			glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+			mapped = (byte*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+			dbg_assert(mapped);
+		} else {
+			glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+		}
 	}
 	
-	bool load () {
-		bool v = load_shader_source(vert_filename, &vert_src);
-		bool f = load_shader_source(frag_filename, &frag_src);
-		if (!v || !f) return false;
+	// waits until the gpu is done with the part written FRAMES_IN_FLIGHT frames ago, which we reuse now
+	static void begin_frame () {
+		if (!buf) return;
 		
-		bool res = load_program();
-		if (res) {
-			get_uniform_locations();
-			setup_uniform_textures();
+		cur_part = (cur_part +1) % FRAMES_IN_FLIGHT;
+		used = 0;
+		
+		auto& fence = fences[cur_part];
+		if (fence) {
+			GLenum res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64)1000000000); // 1s
+			dbg_assert(res != GL_WAIT_FAILED);
+			
+			glDeleteSync(fence);
+			fence = 0;
 		}
-		return res;
 	}
-	bool reload_if_needed () {
-		if (srcf.poll_did_change()) {
-			
-			con_logf("shader source changed, reloading shader \"%s\";\"%s\".", vert_filename.c_str(),frag_filename.c_str());
-			
-			unload_program();
+	static void end_frame () { // after the last command that reads this frames data
+		if (!buf) return;
+		
+		fences[cur_part] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	
+	// copies data into this frames part of buf at an offset that is a multiple of align, false if it does not fit
+	static bool write (void const* data, u64 size, u64 align, u64* offset) {
+		if (!buf) return false;
+		
+		u64 part_begin = cur_part * frame_size;
+		u64 begin = (part_begin +used +align -1) / align * align;
+		if (begin +size > part_begin +frame_size) return false;
+		
+		if (size == 0) {
+			// nothing to copy
+		} else if (mapped) {
+			memcpy(mapped +begin, data, size);
+		} else {
+			gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, buf);
 			
-			srcf.close_all();
-			srcf.v.clear();
+			// unsynchronized is fine, begin_frame() made sure the gpu is done with this part
+			void* p = glMapBufferRange(GL_COPY_WRITE_BUFFER, begin, size, GL_MAP_WRITE_BIT|GL_MAP_UNSYNCHRONIZED_BIT|GL_MAP_INVALIDATE_RANGE_BIT);
+			if (!p) return false;
 			
-			return load();
+			memcpy(p, data, size);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
 		}
-		return false;
+		
+		used = begin +size -part_begin;
+		*offset = begin;
+		return true;
 	}
+}
+
+// Uniform buffers shared by all shaders, the GLSL side is shaders/ubo.glsl (pull it in with $include)
+//  View is written once per frame, Object has one slot per drawn mesh, all slots are written at once and selected with glBindBufferRange
+//  both go into the stream_buffer, view_buf and object_buf are only used if that is disabled or full
+//  the std140 offsets the driver reports are checked against the c++ structs when a shader is linked
+namespace ubo {
+	enum binding_e : GLuint {
+		VIEW_BINDING =		0,
+		OBJECT_BINDING =	1,
+	};
 	
-	void bind () {
-		glUseProgram(prog);
+	struct View {
+		m4		world_to_cam;
+		m4		cam_to_world;
+		m4		cam_to_clip;
+		m4		skybox_to_clip;
+		v2		screen_dim;
+		v2		mcursor_pos;
+	};
+	struct Object {
+		m4		model_to_world;
+		v4		model_col; // multiplied with the vertex colors
+	};
+	
+	struct Member {
+		cstr	name;
+		u32		offset;
+	};
+	struct Block {
+		cstr				name;
+		GLuint				binding;
+		u32					size;
+		std::vector<Member>	members;
+	};
+	
+	#define UBO_MEMBER(STRUCT, MEMBER) Member{ #MEMBER, (u32)offsetof(STRUCT, MEMBER) }
+	
+	static Block blocks[] = {
+		{ "View", VIEW_BINDING, sizeof(View), {
+			UBO_MEMBER(View, world_to_cam),
+			UBO_MEMBER(View, cam_to_world),
+			UBO_MEMBER(View, cam_to_clip),
+			UBO_MEMBER(View, skybox_to_clip),
+			UBO_MEMBER(View, screen_dim),
+			UBO_MEMBER(View, mcursor_pos),
+		}},
+		{ "Object", OBJECT_BINDING, sizeof(Object), {
+			UBO_MEMBER(Object, model_to_world),
+			UBO_MEMBER(Object, model_col),
+		}},
+	};
+	
+	#undef UBO_MEMBER
+	
+	static GLuint			view_buf;
+	static GLuint			object_buf;
+	
+	static u32				offset_align; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	static u32				object_stride; // sizeof(Object) rounded up to offset_align
+	static u32				object_capacity; // slots in object_buf
+	static std::vector<byte>	object_data; // slots of this frame, uploaded in one go
+	
+	static GLuint			object_src_buf; // where the slots of this frame ended up
+	static u64				object_src_offset;
+	
+	static void init () { // after gl init and stream_buffer::init
+		GLint align;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+		
+		offset_align = (u32)align;
+		object_stride = (u32)((sizeof(Object) +align -1) / align * align);
+		object_capacity = 0;
+		
+		glGenBuffers(1, &view_buf);
+		glGenBuffers(1, &object_buf);
+		
+		gl_state::bind_buffer(GL_UNIFORM_BUFFER, view_buf);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(View), NULL, GL_DYNAMIC_DRAW);
+		
+		gl_state::bind_uniform_buffer_base(VIEW_BINDING, view_buf);
 	}
 	
-	Uniform* get_uniform (cstr name) {
-		for (auto& u : uniforms) {
-			if (strcmp(u.name, name) == 0) {
-				return &u;
-			}
+	static void set_view (View const& v) {
+		render_stats::add(render_stats::ST_UPLOAD_BYTES, sizeof(View));
+		
+		u64 offset;
+		if (stream_buffer::write(&v, sizeof(View), offset_align, &offset)) {
+			gl_state::bind_uniform_buffer_range(VIEW_BINDING, stream_buffer::buf, offset, sizeof(View));
+			return;
 		}
-		return nullptr;
+		
+		gl_state::bind_uniform_buffer_base(VIEW_BINDING, view_buf);
+		gl_state::bind_buffer(GL_UNIFORM_BUFFER, view_buf);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(View), &v, GL_DYNAMIC_DRAW); // respecify instead of sub data, so we never wait on the last frame reading it
 	}
 	
-	template <typename T>
-	void set_unif (cstr name, T v) {
-		auto* u = get_uniform(name);
-		if (u) u->set(v);
-		else {
-			dbg_warning("Uniform %s is not a uniform in the shader!", name);
+	static void begin_objects () {
+		object_data.clear();
+	}
+	static u32 push_object (Object const& o) { // returns the slot for bind_object
+		u32 slot = (u32)(object_data.size() / object_stride);
+		object_data.resize(object_data.size() +object_stride);
+		memcpy(&object_data[slot * object_stride], &o, sizeof(Object));
+		return slot;
+	}
+	static void upload_objects () {
+		u32 count = (u32)(object_data.size() / object_stride);
+		if (count == 0) return;
+		
+		render_stats::add(render_stats::ST_UPLOAD_BYTES, object_data.size());
+		
+		if (stream_buffer::write(object_data.data(), object_data.size(), offset_align, &object_src_offset)) {
+			object_src_buf = stream_buffer::buf;
+			return;
 		}
+		
+		object_src_buf = object_buf;
+		object_src_offset = 0;
+		
+		object_capacity = max(object_capacity, round_up_to_pot(count));
+		
+		gl_state::bind_buffer(GL_UNIFORM_BUFFER, object_buf);
+		glBufferData(GL_UNIFORM_BUFFER, object_capacity * object_stride, NULL, GL_DYNAMIC_DRAW); // orphan
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, object_data.size(), object_data.data());
+	}
+	static void bind_object (u32 slot) {
+		gl_state::bind_uniform_buffer_range(OBJECT_BINDING, object_src_buf, object_src_offset +slot * object_stride, sizeof(Object));
 	}
 	
-private:
-	bool load_shader_source (strcr filename, str* src_text) {
+	// assigns the binding points of the blocks the program uses, false if a block does not match its struct
+	static bool setup_program (GLuint prog, strcr vert_filename, strcr frag_filename) {
+		bool valid = true;
 		
-		{
-			str filepath = prints("%s%s", shaders_base_path, filename.c_str());
+		for (auto& b : blocks) {
+			GLuint index = glGetUniformBlockIndex(prog, b.name);
+			if (index == GL_INVALID_INDEX) continue; // not used by this program
 			
-			srcf.v.emplace_back(); // add file to list dependent files even before we know if it exist, so that we can find out when it becomes existant
-			srcf.v.back().init(filepath);
+			glUniformBlockBinding(prog, index, b.binding);
 			
-			if (!read_text_file(filepath.c_str(), src_text)) {
-				con_logf_warning("load_shader_source:: $include \"%s\" could not be loaded!", filename.c_str());
-				return false;
+			GLint size;
+			glGetActiveUniformBlockiv(prog, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+			if ((u32)size != b.size) {
+				con_logf_warning("Uniform block \"%s\" in \"%s\"|\"%s\" is %d bytes, the c++ struct %u bytes!", b.name, vert_filename.c_str(), frag_filename.c_str(), size, b.size);
+				valid = false;
 			}
-		}
-		
-		for (auto c=src_text->begin(); c!=src_text->end();) {
 			
-			if (*c == '$') {
-				auto line_begin = c;
-				++c;
-				
-				auto syntax_error = [&] () {
-					
-					while (*c != '\n' && *c != '\r') ++c;
-					str line (line_begin, c);
-					
-					con_logf_warning("load_shader_source:: expected '$include \"filename\"' syntax but got: '%s'!", line.c_str());
-				};
-				
-				while (*c == ' ' || *c == '\t') ++c;
-				
-				auto cmd = c;
+			std::vector<cstr> names;
+			for (auto& m : b.members) names.push_back(m.name);
+			
+			std::vector<GLuint> indices (names.size());
+			glGetUniformIndices(prog, (GLsizei)names.size(), names.data(), indices.data());
+			
+			for (u32 i=0; i<(u32)b.members.size(); ++i) {
+				auto& m = b.members[i];
 				
-				while ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || *c == '_') ++c;
+				if (indices[i] == GL_INVALID_INDEX) { // std140 members are always active, so it is missing from the block
+					con_logf_warning("Uniform block \"%s\" in \"%s\"|\"%s\" has no member \"%s\"!", b.name, vert_filename.c_str(), frag_filename.c_str(), m.name);
+					valid = false;
+					continue;
+				}
 				
-				if (str(cmd, c).compare("include") == 0) {
-					
-					while (*c == ' ' || *c == '\t') ++c;
-					
-					if (*c != '"') {
-						syntax_error();
-						return false;
-					}
-					++c;
-					
-					auto filename_str_begin = c;
-					
-					while (*c != '"') ++c;
-					
-					str inc_filename(filename_str_begin, c);
-					
-					if (*c != '"') {
-						syntax_error();
-						return false;
-					}
-					++c;
-					
-					while (*c == ' ' || *c == '\t') ++c;
-					
-					if (*c != '\r' && *c != '\n') {
-						syntax_error();
-						return false;
-					}
-					
-					auto line_end = c;
-					
-					{
-						inc_filename = get_path_dir(filename).append(inc_filename);
-						
-						str inc_text;
-						if (!load_shader_source(inc_filename, &inc_text)) return false;
-						
-						auto line_begin_i = line_begin -src_text->begin();
-						
-						src_text->erase(line_begin, line_end);
-						src_text->insert(src_text->begin() +line_begin_i, inc_text.begin(), inc_text.end());
-						
-						c = src_text->begin() +line_begin_i +inc_text.length();
-					}
-					
+				GLint offset;
+				glGetActiveUniformsiv(prog, 1, &indices[i], GL_UNIFORM_OFFSET, &offset);
+				if ((u32)offset != m.offset) {
+					con_logf_warning("Uniform block member \"%s.%s\" in \"%s\"|\"%s\" is at offset %d, in the c++ struct at %u!", b.name, m.name, vert_filename.c_str(), frag_filename.c_str(), offset, m.offset);
+					valid = false;
 				}
-			} else {
-				++c;
 			}
-			
 		}
 		
-		return true;
+		return valid;
 	}
+}
+
+// Per instance data for instanced draws of arena geometry, the same as ubo::Object but as vertex attributes with divisor 1
+//  all instances of a frame are written at once (stream_buffer, or instance_buf if that is full), each group re-points the attributes at its first instance
+//  (no ARB_base_instance in GL 3.3)
+//  vertex shaders opt in with the INSTANCED permutation, see mesh_vertex.vert
+namespace instancing {
+	static bool				enable =			true;
+	static u32				min_instances =		2; // groups smaller than this draw the normal way
+	
+	struct Instance {
+		m4		model_to_world;
+		v4		col;
+	};
 	
-	static bool get_shader_compile_log (GLuint shad, str* log) {
-		GLsizei log_len;
-		{
-			GLint temp = 0;
-			glGetShaderiv(shad, GL_INFO_LOG_LENGTH, &temp);
-			log_len = (GLsizei)temp;
+	static GLuint			model_to_world_loc =	attrib_locations::get("instance_model_to_world", 4);
+	static GLuint			col_loc =				attrib_locations::get("instance_col");
+	
+	static std::vector<Instance>	instances; // of this frame
+	
+	static GLuint			instance_buf =		0;
+	static u64				instance_capacity =	0;
+	
+	static GLuint			src_buf; // where the instances of this frame ended up
+	static u64				src_offset;
+	
+	static void begin () {
+		instances.clear();
+	}
+	static u32 push (Instance const& i) { // returns the index for draw
+		instances.push_back(i);
+		return (u32)instances.size() -1;
+	}
+	static void upload () {
+		if (instances.size() == 0) return;
+		
+		u64 size = instances.size() * sizeof(Instance);
+		render_stats::add(render_stats::ST_UPLOAD_BYTES, size);
+		
+		if (stream_buffer::write(instances.data(), size, sizeof(v4), &src_offset)) {
+			src_buf = stream_buffer::buf;
+			return;
 		}
 		
-		if (log_len <= 1) {
-			return false; // no log available
-		} else {
-			// GL_INFO_LOG_LENGTH includes the null terminator, but it is not allowed to write the null terminator in str, so we have to allocate one additional char and then resize it away at the end
-			
-			log->resize(log_len);
-			
-			GLsizei written_len = 0;
-			glGetShaderInfoLog(shad, log_len, &written_len, &(*log)[0]);
-			dbg_assert(written_len == (log_len -1));
-			
-			log->resize(written_len);
-			
-			return true;
+		if (!instance_buf) glGenBuffers(1, &instance_buf);
+		src_buf = instance_buf;
+		src_offset = 0;
+		
+		instance_capacity = max(instance_capacity, (u64)round_up_to_pot((u32)size));
+		
+		gl_state::bind_buffer(GL_ARRAY_BUFFER, instance_buf);
+		glBufferData(GL_ARRAY_BUFFER, instance_capacity, NULL, GL_STREAM_DRAW); // orphan
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, instances.data());
+	}
+	
+	// with the instanced vao bound
+	static void setup_attrib_arrays () {
+		for (GLuint i=0; i<4; ++i) {
+			glEnableVertexAttribArray(model_to_world_loc +i);
+			glVertexAttribDivisor(model_to_world_loc +i, 1);
 		}
+		glEnableVertexAttribArray(col_loc);
+		glVertexAttribDivisor(col_loc, 1);
 	}
-	static bool get_program_link_log (GLuint prog, str* log) {
-		GLsizei log_len;
-		{
-			GLint temp = 0;
-			glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &temp);
-			log_len = (GLsizei)temp;
+	static void set_pointers (u32 first_instance) {
+		gl_state::bind_buffer(GL_ARRAY_BUFFER, src_buf);
+		
+		u64 base = src_offset +first_instance * sizeof(Instance);
+		for (GLuint i=0; i<4; ++i) {
+			glVertexAttribPointer(model_to_world_loc +i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base +offsetof(Instance, model_to_world) +i * sizeof(v4)));
 		}
+		glVertexAttribPointer(col_loc, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base +offsetof(Instance, col)));
+	}
+}
+
+// linked program binaries in asset_cache_path (ARB_get_program_binary), keyed by the expanded sources and the driver
+//  drivers are free to reject binaries (eg. after an update with the same version string), then we just compile from source
+namespace program_cache {
+	static bool enable = true;
+	
+	static constexpr u32 VERSION = 1;
+	
+	struct Header {
+		char		magic[4];
+		u32			version;
+		u64			key;
+		GLenum		format;
+		u32			size;
+	};
+	
+	static bool supported () {
+		if (!enable || !GLAD_GL_ARB_get_program_binary) return false;
 		
-		if (log_len <= 1) {
-			return false; // no log available
+		static GLint formats = -1;
+		if (formats < 0) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}
+	
+	static u64 calc_key (strcr vert_src, strcr frag_src) {
+		u64 k = FNV1A_OFFSET_BASIS;
+		k = hash_fnv1a(vert_src.data(), vert_src.size(), k);
+		k = hash_fnv1a(frag_src.data(), frag_src.size(), k);
+		k = attrib_locations::hash(k);
+		
+		for (GLenum e : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+			auto* s = (cstr)glGetString(e);
+			if (s) k = hash_fnv1a(s, strlen(s), k);
+		}
+		
+		k = hash_fnv1a(&VERSION, sizeof(VERSION), k);
+		return k;
+	}
+	
+	static str get_filepath (u64 key) {
+		return prints("%sprog_%016llx.bin", asset_cache_path, key);
+	}
+	
+	static bool load (u64 key, GLuint prog) { // false if not cached or the driver rejected the binary
+		FILE* f = fopen(get_filepath(key).c_str(), "rb");
+		if (!f) return false;
+		
+		defer { fclose(f); };
+		
+		Header h;
+		if (fread(&h, 1,sizeof(h), f) != sizeof(h)) return false;
+		
+		if (memcmp(h.magic, "PROG", 4) != 0 || h.version != VERSION || h.key != key || h.size == 0) return false;
+		
+		std::vector<byte> binary (h.size);
+		if (fread(binary.data(), 1,h.size, f) != h.size) return false;
+		
+		glProgramBinary(prog, h.format, binary.data(), (GLsizei)h.size);
+		
+		GLint status;
+		glGetProgramiv(prog, GL_LINK_STATUS, &status);
+		return status == GL_TRUE;
+	}
+	static void write (u64 key, GLuint prog) {
+		GLint size = 0;
+		glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &size);
+		if (size <= 0) return;
+		
+		Header h = {};
+		memcpy(h.magic, "PROG", 4);
+		h.version =	VERSION;
+		h.key =		key;
+		
+		std::vector<byte> binary (size);
+		GLsizei written = 0;
+		glGetProgramBinary(prog, size, &written, &h.format, binary.data());
+		if (written <= 0) return;
+		
+		h.size = (u32)written;
+		
+		create_asset_cache_dir();
+		
+		auto filepath = get_filepath(key);
+		
+		FILE* f = fopen(filepath.c_str(), "wb");
+		if (!f) return; // just compile again next time
+		
+		defer { fclose(f); };
+		
+		fwrite(&h, 1,sizeof(h), f);
+		fwrite(binary.data(), 1,h.size, f);
+	}
+}
+
+// Shader source preprocessing, expands '$include "filename"' lines in one pass
+//  included files get parsed once into segments (text up to the next directive) and are shared by all shaders, they only get reparsed when the file changed
+//  files with '#pragma once' are only included once per shader
+//  '#line <line> <file index>' directives map compile errors back to the files, the file index is the source string number in the driver log
+namespace shader_preprocessor {
+	
+	struct Segment {
+		u64		begin; // text [begin, end)
+		u64		end;
+		u32		line; // line number of begin
+		str		include; // file that gets included after the text, empty for none
+	};
+	
+	struct File {
+		str						filename; // relative to shaders_base_path
+		Source_File				srcf; // to notice changes
+		bool					valid;
+		
+		str						text;
+		bool					once;
+		std::vector<Segment>	segments;
+	};
+	
+	static std::vector<File*>	files;
+	
+	static bool parse (File* f) {
+		f->segments.clear();
+		f->once = false;
+		
+		if (!read_text_file(f->srcf.filepath.c_str(), &f->text)) return false;
+		
+		str const& t = f->text;
+		
+		auto skip_whitespace = [&] (u64 i) {
+			while (i < t.size() && (t[i] == ' ' || t[i] == '\t')) ++i;
+			return i;
+		};
+		auto skip_identifier = [&] (u64 i) {
+			while (i < t.size() && ((t[i] >= 'a' && t[i] <= 'z') || (t[i] >= 'A' && t[i] <= 'Z') || t[i] == '_')) ++i;
+			return i;
+		};
+		
+		u64 seg_begin = 0;
+		u32 seg_line = 1;
+		
+		u32 line = 1;
+		for (u64 line_begin=0; line_begin<t.size(); ++line) {
+			u64 line_end = t.find('\n', line_begin);
+			if (line_end == str::npos) line_end = t.size();
+			u64 next_line = min(line_end +1, (u64)t.size());
+			
+			u64 c = skip_whitespace(line_begin);
+			
+			bool include = false;
+			bool pragma_once = false;
+			str inc_filename;
+			
+			if (c < t.size() && t[c] == '$') {
+				auto syntax_error = [&] () {
+					u64 end = line_end;
+					if (end > line_begin && t[end -1] == '\r') --end;
+					con_logf_warning("load_shader_source:: expected '$include \"filename\"' syntax but got: '%s' in \"%s\"!", t.substr(line_begin, end -line_begin).c_str(), f->filename.c_str());
+				};
+				
+				u64 cmd = skip_whitespace(c +1);
+				c = skip_identifier(cmd);
+				if (t.compare(cmd, c -cmd, "include") != 0) {
+					syntax_error();
+					return false;
+				}
+				
+				c = skip_whitespace(c);
+				if (c == t.size() || t[c] != '"') {
+					syntax_error();
+					return false;
+				}
+				u64 name_begin = ++c;
+				while (c < line_end && t[c] != '"') ++c;
+				if (c == line_end) {
+					syntax_error();
+					return false;
+				}
+				inc_filename = t.substr(name_begin, c -name_begin);
+				
+				c = skip_whitespace(c +1);
+				if (c != line_end && t[c] != '\r') {
+					syntax_error();
+					return false;
+				}
+				include = true;
+				
+			} else if (t.compare(c, 7, "#pragma") == 0) {
+				u64 arg = skip_whitespace(c +7);
+				u64 arg_end = skip_identifier(arg);
+				pragma_once = t.compare(arg, arg_end -arg, "once") == 0;
+			}
+			
+			if (include || pragma_once) {
+				Segment s = { seg_begin, line_begin, seg_line, "" };
+				if (include) s.include = get_path_dir(f->filename).append(inc_filename);
+				else f->once = true; // the pragma line itself is dropped
+				
+				f->segments.push_back(s);
+				
+				seg_begin = next_line;
+				seg_line = line +1;
+			}
+			
+			line_begin = next_line;
+		}
+		
+		f->segments.push_back({ seg_begin, t.size(), seg_line, "" });
+		return true;
+	}
+	
+	static File* get_file (strcr filename) {
+		for (auto* f : files) {
+			if (f->filename.compare(filename) == 0) {
+				if (f->srcf.poll_did_change() || !f->valid) f->valid = parse(f);
+				return f->valid ? f : nullptr;
+			}
+		}
+		
+		auto* f = new File;
+		f->filename = filename;
+		f->srcf.init(prints("%s%s", shaders_base_path, filename.c_str()));
+		f->valid = parse(f);
+		
+		files.push_back(f);
+		return f->valid ? f : nullptr;
+	}
+	
+	// appends the expanded source of filename to out
+	//  deps gets all files the result depends on (even if they failed to load, so we notice when they appear)
+	//  source_strings gets the files in the order of their #line file index
+	static bool expand (strcr filename, Source_Files* deps, std::vector<str>* source_strings, str* out, u32 depth=0) {
+		if (depth > 32) {
+			con_logf_warning("load_shader_source:: $include recursion too deep at \"%s\"!", filename.c_str());
+			return false;
+		}
+		
+		deps->v.emplace_back();
+		deps->v.back().init(prints("%s%s", shaders_base_path, filename.c_str()));
+		
+		auto* f = get_file(filename);
+		if (!f) {
+			con_logf_warning("load_shader_source:: $include \"%s\" could not be loaded!", filename.c_str());
+			return false;
+		}
+		
+		if (f->once) {
+			for (auto& s : *source_strings) if (s.compare(filename) == 0) return true;
+		}
+		
+		u32 file_index = (u32)source_strings->size();
+		source_strings->push_back(filename);
+		
+		for (auto& s : f->segments) {
+			if (s.end > s.begin) {
+				if (depth > 0 || s.begin > 0) { // not in front of the #version line
+					if (out->size() > 0 && out->back() != '\n') out->push_back('\n');
+					
+					*out += prints("#line %u %u\n", s.line -1, file_index); // in glsl 1.50 the line after '#line n' is line n+1
+				}
+				out->append(f->text, s.begin, s.end -s.begin);
+			}
+			
+			if (!s.include.empty() && !expand(s.include, deps, source_strings, out, depth +1)) return false;
+		}
+		return true;
+	}
+	
+	static str get_source_string_legend (std::vector<str> const& source_strings) { // for the driver logs, which only know the file index
+		str legend = "source strings:";
+		for (u32 i=0; i<(u32)source_strings.size(); ++i) {
+			legend += prints(" %u: \"%s\"", i, source_strings[i].c_str());
+		}
+		return legend;
+	}
+}
+
+// set if the driver supports KHR/ARB_parallel_shader_compile, then compiles happen on driver threads and we can poll for completion
+static bool parallel_shader_compile = false;
+
+// draw with the DEBUG variants of the shaders (DBG_COL, SPLIT_LEFT etc. in common.glsl), they are compiled the first time they are needed
+static bool shader_debug = false;
+
+struct Shader {
+	str								vert_filename;
+	str								frag_filename;
+	
+	Source_Files					srcf;
+	
+	str								vert_src;
+	str								frag_src;
+	
+	std::vector<str>				vert_source_strings; // files by #line file index, see shader_preprocessor
+	std::vector<str>				frag_source_strings;
+	
+	// permutation of the shader files, "NAME" or "NAME VALUE" (NAME alone is defined as 1), sorted so the same set gives the same key
+	std::vector<str>				defines;
+	u64								permutation_key;
+	
+	std::vector<Shader*>			variants; // other permutations of the same files, created by get_variant()
+	
+	u32								sort_id; // small unique number for the render_queue sort keys
+	bool							instanced =		false; // reads the instancing attributes (INSTANCED permutation of mesh_vertex.vert)
+	
+	struct Uniform_Texture {
+		GLint			tex_unit;
+		GLint			loc;
+		cstr			name;
+		
+		Uniform_Texture (GLint unit, cstr n): tex_unit{unit}, name{n} {}
+	};
+	
+	GLuint							prog;
+	
+	// program being compiled and linked by begin_load(), becomes prog in finish_load() if it succeeded
+	//  the compile and link status is only queried in finish_load(), so drivers can compile in the background in the mean time
+	struct Pending {
+		GLuint	prog;
+		GLuint	vert;
+		GLuint	frag;
+		
+		bool	from_cache;
+		u64		cache_key;
+	};
+	Pending							pending;
+	
+	std::vector<Uniform>			uniforms; // the active uniforms of prog, queried after linking
+	std::vector<u32>				uniform_slots; // open addressing table of Uniform_Id hash -> index into uniforms +1 (0 is empty), so lookups per draw are O(1)
+	std::vector<Uniform_Texture>	textures;
+	
+	Shader (strcr v, strcr f, std::vector<Uniform_Texture> const& t, std::vector<str> const& d={}):
+			vert_filename{v}, frag_filename{f}, prog{0}, pending{}, textures{t} {
+		defines = normalize_defines(d);
+		permutation_key = calc_permutation_key(defines);
+		
+		static u32 next_sort_id = 0;
+		sort_id = next_sort_id++;
+	}
+	
+	~Shader () {
+		for (auto* v : variants) delete v;
+		
+		cancel_load();
+		unload_program();
+		srcf.close_all();
+	}
+	
+	static std::vector<str> normalize_defines (std::vector<str> d) {
+		std::sort(d.begin(), d.end());
+		d.erase(std::unique(d.begin(), d.end()), d.end());
+		return d;
+	}
+	static u64 calc_permutation_key (std::vector<str> const& d) {
+		u64 h = FNV1A_OFFSET_BASIS;
+		for (auto& s : d) h = hash_fnv1a(s.c_str(), s.size() +1, h); // including the null terminator as separator
+		return h;
+	}
+	
+	// this shader with extra_defines added, the variant is created and its compile submitted on the first call
+	//  does not block, so check valid() and keep using this shader until the variant is ready
+	Shader* get_variant (std::vector<str> const& extra_defines) {
+		auto d = defines;
+		d.insert(d.end(), extra_defines.begin(), extra_defines.end());
+		d = normalize_defines(d);
+		
+		u64 key = calc_permutation_key(d);
+		if (key == permutation_key) return this;
+		
+		Shader* v = nullptr;
+		for (auto* i : variants) {
+			if (i->permutation_key == key) {
+				v = i;
+				break;
+			}
+		}
+		
+		if (!v) {
+			v = new Shader(vert_filename, frag_filename, textures, d);
+			v->begin_load();
+			variants.push_back(v);
+		}
+		
+		if (v->is_load_pending() && v->is_load_done()) v->finish_load();
+		return v;
+	}
+	bool has_define (cstr name) {
+		u64 len = strlen(name);
+		for (auto& d : defines) {
+			if (d.compare(0, len, name) == 0 && (d.size() == len || d[len] == ' ')) return true;
+		}
+		return false;
+	}
+	
+	// the shader to draw with, depending on shader_debug
+	Shader* get_draw_variant () {
+		if (!shader_debug) return this;
+		
+		auto* v = get_variant({ "DEBUG" });
+		return v->valid() ? v : this;
+	}
+	
+	bool valid () {
+		return prog != 0;
+	}
+	
+	bool load () { // blocking
+		if (!begin_load()) return false;
+		return finish_load();
+	}
+	
+	// preprocesses the sources and submits the compile and link, false if that already failed
+	bool begin_load () {
+		cancel_load();
+		
+		bool v = load_shader_source(vert_filename, &vert_source_strings, &vert_src);
+		bool f = load_shader_source(frag_filename, &frag_source_strings, &frag_src);
+		if (!v || !f) return false;
+		
+		begin_program();
+		return true;
+	}
+	bool is_load_pending () {
+		return pending.prog != 0;
+	}
+	bool is_load_done () { // can we call finish_load() without blocking (always true without parallel shader compile support)
+		if (!is_load_pending() || pending.from_cache) return true;
+		
+		if (!parallel_shader_compile) return true;
+		
+		GLint done = GL_TRUE;
+		glGetProgramiv(pending.prog, GL_COMPLETION_STATUS_KHR, &done); // same enum for the ARB extension
+		return done == GL_TRUE;
+	}
+	// checks the results, swaps in the new program on success, keeps the old one otherwise
+	bool finish_load () {
+		if (!is_load_pending()) return false;
+		
+		bool success = finish_program();
+		if (success) success = ubo::setup_program(pending.prog, vert_filename, frag_filename);
+		if (success) attrib_locations::check_program(pending.prog, vert_filename);
+		
+		if (success) {
+			unload_program();
+			prog = pending.prog;
+			
+			get_uniform_locations();
+			setup_uniform_textures();
+			
+			instanced = glGetAttribLocation(prog, "instance_model_to_world") >= 0;
+		} else {
+			gl_state::delete_program(pending.prog);
+		}
+		
+		pending = {};
+		return success;
+	}
+	void cancel_load () {
+		if (!is_load_pending()) return;
+		
+		if (pending.vert) glDeleteShader(pending.vert);
+		if (pending.frag) glDeleteShader(pending.frag);
+		gl_state::delete_program(pending.prog);
+		
+		pending = {};
+	}
+	
+	// never blocks if the driver compiles in parallel, returns true once the reloaded program is in use
+	bool reload_if_needed () {
+		if (srcf.poll_did_change()) {
+			
+			con_logf("shader source changed, reloading shader \"%s\";\"%s\".", vert_filename.c_str(),frag_filename.c_str());
+			
+			srcf.close_all();
+			srcf.v.clear();
+			
+			if (!begin_load()) return false;
+		}
+		
+		for (auto* v : variants) v->reload_if_needed();
+		
+		if (is_load_pending() && is_load_done()) return finish_load();
+		return false;
+	}
+	
+	void bind () {
+		render_stats::add(render_stats::ST_SHADER_BINDS);
+		gl_state::use_program(prog);
+	}
+	
+	Uniform* get_uniform (Uniform_Id id) { // nullptr if the program has no such active uniform
+		if (uniform_slots.size() == 0) return nullptr;
+		
+		u32 mask = (u32)uniform_slots.size() -1;
+		for (u32 i=id.hash & mask;; i = (i +1) & mask) { // the table is never full
+			u32 slot = uniform_slots[i];
+			if (slot == 0) return nullptr;
+			auto& u = uniforms[slot -1];
+			if (u.hash == id.hash && strcmp(u.name.c_str(), id.name) == 0) return &u; // a different name with the same hash (say of a uniform that is not active) must not match
+		}
+	}
+	
+	// uniforms the compiler optimized away are not active and silently ignored, like glUniform with location -1
+	template <typename T>
+	void set_unif (Uniform_Id id, T v) {
+		auto* u = get_uniform(id);
+		if (u) u->set(v);
+	}
+	template <typename T>
+	void set_unif (Uniform_Id id, T const* arr, u32 count) {
+		auto* u = get_uniform(id);
+		if (u) u->set(arr, count);
+	}
+	
+private:
+	bool load_shader_source (strcr filename, std::vector<str>* source_strings, str* src_text) {
+		source_strings->clear();
+		src_text->clear();
+		
+		if (!shader_preprocessor::expand(filename, &srcf, source_strings, src_text)) return false;
+		
+		if (defines.size() > 0) { // right after the #version line, which has to come first
+			u64 pos = 0;
+			if (src_text->compare(0, 8, "#version") == 0) {
+				pos = src_text->find('\n');
+				pos = pos == str::npos ? src_text->size() : pos +1;
+			}
+			
+			str text;
+			for (auto& d : defines) {
+				auto space = d.find(' ');
+				text += space == str::npos ? prints("#define %s 1\n", d.c_str()) : prints("#define %s\n", d.c_str());
+			}
+			text += prints("#line %u 0\n", pos > 0 ? 1 : 0); // back to the line numbers of the file
+			
+			src_text->insert(pos, text);
+		}
+		return true;
+	}
+	
+	static bool get_shader_compile_log (GLuint shad, str* log) {
+		GLsizei log_len;
+		{
+			GLint temp = 0;
+			glGetShaderiv(shad, GL_INFO_LOG_LENGTH, &temp);
+			log_len = (GLsizei)temp;
+		}
+		
+		if (log_len <= 1) {
+			return false; // no log available
+		} else {
+			// GL_INFO_LOG_LENGTH includes the null terminator, but it is not allowed to write the null terminator in str, so we have to allocate one additional char and then resize it away at the end
+			
+			log->resize(log_len);
+			
+			GLsizei written_len = 0;
+			glGetShaderInfoLog(shad, log_len, &written_len, &(*log)[0]);
+			dbg_assert(written_len == (log_len -1));
+			
+			log->resize(written_len);
+			
+			return true;
+		}
+	}
+	static bool get_program_link_log (GLuint prog, str* log) {
+		GLsizei log_len;
+		{
+			GLint temp = 0;
+			glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &temp);
+			log_len = (GLsizei)temp;
+		}
+		
+		if (log_len <= 1) {
+			return false; // no log available
 		} else {
 			// GL_INFO_LOG_LENGTH includes the null terminator, but it is not allowed to write the null terminator in str, so we have to allocate one additional char and then resize it away at the end
 			
@@ -1200,28 +2785,31 @@ private:
 		}
 	}
 	
-	static bool load_shader (GLenum type, strcr filename, strcr source, GLuint* shad) {
-		*shad = glCreateShader(type);
+	static GLuint begin_shader (GLenum type, strcr source) {
+		GLuint shad = glCreateShader(type);
 		
 		{
 			cstr ptr = source.c_str();
-			glShaderSource(*shad, 1, &ptr, NULL);
+			glShaderSource(shad, 1, &ptr, NULL);
 		}
 		
-		glCompileShader(*shad);
-		
+		glCompileShader(shad);
+		return shad;
+	}
+	static bool finish_shader (GLuint shad, strcr filename, std::vector<str> const& source_strings) {
 		bool success;
 		{
 			GLint status;
-			glGetShaderiv(*shad, GL_COMPILE_STATUS, &status);
+			glGetShaderiv(shad, GL_COMPILE_STATUS, &status);
 			
 			str log_str;
-			bool log_avail = get_shader_compile_log(*shad, &log_str);
+			bool log_avail = get_shader_compile_log(shad, &log_str);
 			
 			success = status == GL_TRUE;
 			if (!success) {
 				// compilation failed
-				con_logf_warning("OpenGL error in shader compilation \"%s\"!\n>>>\n%s\n<<<\n", filename.c_str(), log_avail ? log_str.c_str() : "<no log available>");
+				con_logf_warning("OpenGL error in shader compilation \"%s\"!\n>>>\n%s\n<<<\n%s\n", filename.c_str(), log_avail ? log_str.c_str() : "<no log available>",
+						shader_preprocessor::get_source_string_legend(source_strings).c_str());
 			} else {
 				// compilation success
 				if (log_avail) {
@@ -1232,32 +2820,48 @@ private:
 		
 		return success;
 	}
-	bool load_program () {
-		
-		prog = glCreateProgram();
+	
+	void begin_program () {
+		pending.prog = glCreateProgram();
 		
-		GLuint vert;
-		GLuint frag;
+		bool cache = program_cache::supported();
+		pending.cache_key = cache ? program_cache::calc_key(vert_src, frag_src) : 0;
 		
-		if (	!load_shader(GL_VERTEX_SHADER,		vert_filename, vert_src, &vert) ||
-				!load_shader(GL_FRAGMENT_SHADER,	frag_filename, frag_src, &frag)) {
-			unload_program();
-			prog = 0;
-			return false;
+		if (cache) {
+			if (program_cache::load(pending.cache_key, pending.prog)) {
+				pending.from_cache = true;
+				return;
+			}
+			
+			// a rejected binary can leave the program in an undefined state, start with a fresh one
+			gl_state::delete_program(pending.prog);
+			pending.prog = glCreateProgram();
+			
+			glProgramParameteri(pending.prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		}
 		
-		glAttachShader(prog, vert);
-		glAttachShader(prog, frag);
+		pending.vert = begin_shader(GL_VERTEX_SHADER,	vert_src);
+		pending.frag = begin_shader(GL_FRAGMENT_SHADER,	frag_src);
 		
-		glLinkProgram(prog);
+		glAttachShader(pending.prog, pending.vert);
+		glAttachShader(pending.prog, pending.frag);
 		
-		bool success;
-		{
+		attrib_locations::bind(pending.prog);
+		
+		glLinkProgram(pending.prog); // fails if a shader failed to compile, which we only check in finish_program()
+	}
+	bool finish_program () {
+		if (pending.from_cache) return true; // link status was already checked
+		
+		bool success =	finish_shader(pending.vert, vert_filename, vert_source_strings);
+		success =		finish_shader(pending.frag, frag_filename, frag_source_strings) && success;
+		
+		if (success) {
 			GLint status;
-			glGetProgramiv(prog, GL_LINK_STATUS, &status);
+			glGetProgramiv(pending.prog, GL_LINK_STATUS, &status);
 			
 			str log_str;
-			bool log_avail = get_program_link_log(prog, &log_str);
+			bool log_avail = get_program_link_log(pending.prog, &log_str);
 			
 			success = status == GL_TRUE;
 			if (!success) {
@@ -1271,26 +2875,66 @@ private:
 			}
 		}
 		
-		glDetachShader(prog, vert);
-		glDetachShader(prog, frag);
+		glDetachShader(pending.prog, pending.vert);
+		glDetachShader(pending.prog, pending.frag);
 		
-		glDeleteShader(vert);
-		glDeleteShader(frag);
+		glDeleteShader(pending.vert);
+		glDeleteShader(pending.frag);
+		pending.vert = 0;
+		pending.frag = 0;
+		
+		if (success && pending.cache_key) program_cache::write(pending.cache_key, pending.prog);
 		
 		return success;
 	}
 	void unload_program () {
-		glDeleteProgram(prog); // 0 for prog is valid (silently ignored)
+		gl_state::delete_program(prog); // 0 for prog is valid (silently ignored)
 	}
 	
 	void get_uniform_locations () {
-		for (auto& u : uniforms) {
-			u.loc = glGetUniformLocation(prog, u.name);
-			//if (u.loc <= -1) log_warning("Uniform not valid %s!", u.name);
+		uniforms.clear();
+		
+		GLint count = 0;
+		GLint max_len = 0;
+		glGetProgramiv(prog, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(prog, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_len);
+		
+		str name_buf;
+		name_buf.resize(max(max_len, 1));
+		
+		for (GLint i=0; i<count; ++i) {
+			GLsizei len = 0;
+			GLint size;
+			GLenum gl_type;
+			glGetActiveUniform(prog, (GLuint)i, (GLsizei)name_buf.size(), &len, &size, &gl_type, &name_buf[0]);
+			
+			str name (name_buf.data(), len);
+			if (name.size() > 3 && name.compare(name.size() -3, 3, "[0]") == 0) name.resize(name.size() -3); // arrays are reported as name[0]
+			
+			data_type type;
+			if (!get_data_type(gl_type, &type)) continue;
+			
+			GLint loc = glGetUniformLocation(prog, name.c_str());
+			if (loc < 0) continue; // in a uniform block
+			
+			uniforms.emplace_back(type, name, loc);
+			
+			for (u32 j=0; j<(u32)uniforms.size() -1; ++j) {
+				dbg_assert(uniforms[j].hash != uniforms.back().hash, "uniform name hash collision '%s' '%s'", uniforms[j].name.c_str(), name.c_str());
+			}
+		}
+		
+		uniform_slots.assign(uniforms.size() > 0 ? round_up_to_pot((u32)uniforms.size() * 2) : 0, 0); // at most half full
+		u32 mask = (u32)uniform_slots.size() -1;
+		
+		for (u32 j=0; j<(u32)uniforms.size(); ++j) {
+			u32 i = uniforms[j].hash & mask;
+			while (uniform_slots[i] != 0) i = (i +1) & mask;
+			uniform_slots[i] = j +1;
 		}
 	}
 	void setup_uniform_textures () {
-		glUseProgram(prog);
+		gl_state::use_program(prog);
 		for (auto& t : textures) {
 			t.loc = glGetUniformLocation(prog, t.name);
 			//if (t.loc <= -1) log_warning("Uniform Texture not valid '%s'!", t.name);
@@ -1300,81 +2944,404 @@ private:
 	
 };
 
+struct Geometry_Arena;
+
 struct Vertex_Layout {
 	struct Attribute {
 		cstr		name;
 		data_type	type;
 		u64			stride;
 		u64			offs;
+		
+		GLuint		loc; // from attrib_locations
 	};
 	
 	std::vector<Attribute>	attribs;
 	
-	Vertex_Layout (std::initializer_list<Attribute> a): attribs{a} {}
+	Geometry_Arena*			arena; // created by the first VBO_ARENA Vbo
 	
-	u32 bind_attrib_arrays (Shader const* shad) {
-		u32 vertex_size = 0;
-		
+	Vertex_Layout (std::initializer_list<Attribute> a): attribs{a}, arena{nullptr} {
+		for (auto& a : attribs) a.loc = attrib_locations::get(a.name);
+	}
+	
+	u32 get_vertex_size () {
+		return attribs.size() > 0 ? (u32)attribs[0].stride : 0;
+	}
+	
+	// with the VAO and the vertex buffer bound, the VAO remembers this
+	void setup_attrib_arrays () {
 		for (auto& a : attribs) {
-			
-			GLint loc = glGetAttribLocation(shad->prog, a.name);
-			//if (loc <= -1) con_logf_warning("Attribute %s is not used in the shader!", a.name);
-			
-			if (loc != -1) {
-				dbg_assert(loc > -1);
-				
-				glEnableVertexAttribArray(loc);
+			GLint comps = 1;
+			GLenum type = GL_FLOAT;
+			switch (a.type) {
+				case T_FLT:	comps = 1;	type = GL_FLOAT;	break;
+				case T_V2:	comps = 2;	type = GL_FLOAT;	break;
+				case T_V3:	comps = 3;	type = GL_FLOAT;	break;
+				case T_V4:	comps = 4;	type = GL_FLOAT;	break;
 				
-				GLint comps = 1;
-				GLenum type = GL_FLOAT;
-				u32 size = sizeof(f32);
-				switch (a.type) {
-					case T_FLT:	comps = 1;	type = GL_FLOAT;	size = sizeof(f32);	break;
-					case T_V2:	comps = 2;	type = GL_FLOAT;	size = sizeof(f32);	break;
-					case T_V3:	comps = 3;	type = GL_FLOAT;	size = sizeof(f32);	break;
-					case T_V4:	comps = 4;	type = GL_FLOAT;	size = sizeof(f32);	break;
-					
-					case T_INT:	comps = 1;	type = GL_INT;		size = sizeof(s32);	break;
-					case T_IV2:	comps = 2;	type = GL_INT;		size = sizeof(s32);	break;
-					case T_IV3:	comps = 3;	type = GL_INT;		size = sizeof(s32);	break;
-					case T_IV4:	comps = 4;	type = GL_INT;		size = sizeof(s32);	break;
-					
-					default: dbg_assert(false);
-				}
-				
-				vertex_size += size;
-				
-				glVertexAttribPointer(loc, comps, type, GL_FALSE, a.stride, (void*)a.offs);
+				case T_INT:	comps = 1;	type = GL_INT;		break;
+				case T_IV2:	comps = 2;	type = GL_INT;		break;
+				case T_IV3:	comps = 3;	type = GL_INT;		break;
+				case T_IV4:	comps = 4;	type = GL_INT;		break;
 				
+				default: dbg_assert(false);
 			}
+			
+			glEnableVertexAttribArray(a.loc);
+			glVertexAttribPointer(a.loc, comps, type, GL_FALSE, a.stride, (void*)a.offs);
+		}
+	}
+};
+
+// first fit free list over [0, capacity), for the ranges of vertices and indices in the Geometry_Arenas
+struct Range_Allocator {
+	struct Range {
+		u64		begin;
+		u64		size;
+	};
+	
+	u64					capacity =	0;
+	std::vector<Range>	free_ranges; // sorted by begin, adjacent ranges are merged
+	
+	bool alloc (u64 size, u64* begin) {
+		if (size == 0) {
+			*begin = 0;
+			return true;
 		}
 		
-		return vertex_size;
+		for (u32 i=0; i<(u32)free_ranges.size(); ++i) {
+			auto& r = free_ranges[i];
+			if (r.size < size) continue;
+			
+			*begin = r.begin;
+			r.begin += size;
+			r.size -= size;
+			if (r.size == 0) free_ranges.erase(free_ranges.begin() +i);
+			return true;
+		}
+		return false;
+	}
+	void free (u64 begin, u64 size) {
+		if (size == 0) return;
+		
+		auto it = std::lower_bound(free_ranges.begin(), free_ranges.end(), begin, [] (Range const& r, u64 b) { return r.begin < b; });
+		it = free_ranges.insert(it, { begin, size });
+		
+		auto next = it +1;
+		if (next != free_ranges.end() && it->begin +it->size == next->begin) {
+			it->size += next->size;
+			free_ranges.erase(next);
+		}
+		if (it != free_ranges.begin()) {
+			auto prev = it -1;
+			if (prev->begin +prev->size == it->begin) {
+				prev->size += it->size;
+				free_ranges.erase(it);
+			}
+		}
+	}
+	
+	void grow (u64 new_capacity) {
+		dbg_assert(new_capacity >= capacity);
+		u64 old = capacity;
+		capacity = new_capacity;
+		free(old, new_capacity -old);
+	}
+	void reset (u64 used) { // everything below used is allocated, the rest free
+		free_ranges.clear();
+		if (used < capacity) free_ranges.push_back({ used, capacity -used });
+	}
+	
+	u64 get_free () {
+		u64 sum = 0;
+		for (auto& r : free_ranges) sum += r.size;
+		return sum;
+	}
+	u64 get_free_at_end () {
+		if (free_ranges.size() == 0 || free_ranges.back().begin +free_ranges.back().size != capacity) return 0;
+		return free_ranges.back().size;
+	}
+	
+	u64 get_grown_capacity (u64 size, u64 min_capacity) { // capacity after doubling until an allocation of size fits at the end
+		u64 c = max(capacity, min_capacity);
+		while (c -capacity +get_free_at_end() < size) c *= 2;
+		return c;
+	}
+};
+
+// Vertex and index buffers shared by all static meshes with the same Vertex_Layout, so drawing different meshes does not switch buffers or VAOs
+//  each mesh gets a range of vertices and indices and draws with glDrawElementsBaseVertex
+//  grows by doubling (copied on the gpu), freed ranges get reused and compact_if_fragmented() closes the holes hot reloading leaves behind
+//  identical geometry (the same file loaded for multiple meshes) shares one refcounted allocation, so its draws can be instanced
+struct Geometry_Arena {
+	struct Allocation {
+		u64		vert_begin; // in vertices
+		u64		vert_count;
+		u64		indx_begin; // in indices
+		u64		indx_count;
+		
+		u64		hash; // of the data
+		u32		refs;
+		u32		id; // small unique number for the render_queue sort keys
+	};
+	
+	static constexpr u64		MIN_VERTS =	64 * 1024;
+	static constexpr u64		MIN_INDXS =	256 * 1024;
+	
+	Vertex_Layout*				layout;
+	u32							vertex_size;
+	
+	GLuint						vao =		0;
+	GLuint						vao_instanced =	0; // vao + the instancing attributes
+	GLuint						vbo_vert =	0;
+	GLuint						vbo_indx =	0;
+	
+	u32							next_id =	0;
+	
+	Range_Allocator				verts;
+	Range_Allocator				indxs;
+	
+	std::vector<Allocation*>	allocations; // live ones, so compaction can move them
+	
+	Geometry_Arena (Vertex_Layout* l): layout{l}, vertex_size{l->get_vertex_size()} {}
+	
+	Allocation* alloc (std::vector<byte> const& vert_data, std::vector<vert_indx_t> const& indx_data) {
+		u64 hash = hash_fnv1a(vert_data.data(), vert_data.size());
+		hash = hash_fnv1a(indx_data.data(), indx_data.size() * sizeof(vert_indx_t), hash);
+		
+		for (auto* a : allocations) {
+			if (a->hash == hash && a->vert_count == vert_data.size() / vertex_size && a->indx_count == indx_data.size()) {
+				++a->refs;
+				return a;
+			}
+		}
+		
+		auto* a = new Allocation;
+		a->vert_count = vert_data.size() / vertex_size;
+		a->indx_count = indx_data.size();
+		a->hash = hash;
+		a->refs = 1;
+		a->id = next_id++;
+		
+		if (!verts.alloc(a->vert_count, &a->vert_begin)) {
+			rebuild(verts.get_grown_capacity(a->vert_count, MIN_VERTS), indxs.capacity, false);
+			verts.alloc(a->vert_count, &a->vert_begin);
+		}
+		if (!indxs.alloc(a->indx_count, &a->indx_begin)) {
+			rebuild(verts.capacity, indxs.get_grown_capacity(a->indx_count, MIN_INDXS), false);
+			indxs.alloc(a->indx_count, &a->indx_begin);
+		}
+		
+		upload_range(vbo_vert, a->vert_begin * vertex_size, vert_data.data(), a->vert_count * vertex_size);
+		upload_range(vbo_indx, a->indx_begin * sizeof(vert_indx_t), indx_data.data(), a->indx_count * sizeof(vert_indx_t));
+		
+		allocations.push_back(a);
+		return a;
+	}
+	void free (Allocation* a) {
+		if (--a->refs > 0) return;
+		
+		verts.free(a->vert_begin, a->vert_count);
+		indxs.free(a->indx_begin, a->indx_count);
+		
+		allocations.erase(std::find(allocations.begin(), allocations.end(), a));
+		delete a;
+	}
+	
+	// compacts once the holes waste a quarter of the arena
+	void compact_if_fragmented () {
+		u64 vert_holes = verts.get_free() -verts.get_free_at_end();
+		u64 indx_holes = indxs.get_free() -indxs.get_free_at_end();
+		
+		if (vert_holes * 4 > verts.capacity || indx_holes * 4 > indxs.capacity) {
+			con_logf("compacting geometry arena (%llu vertices, %llu indices in holes)", vert_holes, indx_holes);
+			rebuild(verts.capacity, indxs.capacity, true);
+		}
+	}
+	
+	void bind () {
+		gl_state::bind_vertex_array(vao);
+	}
+	static u64 get_triangle_count (Allocation const* a) {
+		return (a->indx_count > 0 ? a->indx_count : a->vert_count) / 3;
+	}
+	
+	void draw (Allocation const* a) { // with the vao bound
+		if (get_triangle_count(a) > 0) render_stats::draw(get_triangle_count(a));
+		
+		if (a->indx_count > 0) {
+			glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)a->indx_count, GL_UNSIGNED_INT, (void*)(a->indx_begin * sizeof(vert_indx_t)), (GLint)a->vert_begin);
+		} else if (a->vert_count > 0) {
+			glDrawArrays(GL_TRIANGLES, (GLint)a->vert_begin, (GLsizei)a->vert_count);
+		}
+	}
+	// count instances starting at first_instance of this frames instancing::instances
+	void draw_instanced (Allocation const* a, u32 first_instance, u32 count) {
+		gl_state::bind_vertex_array(vao_instanced);
+		instancing::set_pointers(first_instance);
+		
+		if (get_triangle_count(a) > 0) render_stats::draw(get_triangle_count(a), count);
+		
+		if (a->indx_count > 0) {
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)a->indx_count, GL_UNSIGNED_INT, (void*)(a->indx_begin * sizeof(vert_indx_t)), (GLsizei)count, (GLint)a->vert_begin);
+		} else if (a->vert_count > 0) {
+			// vert_begin as first, so no base vertex needed
+			glDrawArraysInstanced(GL_TRIANGLES, (GLint)a->vert_begin, (GLsizei)a->vert_count, (GLsizei)count);
+		}
+	}
+	
+private:
+	static void upload_range (GLuint buf, u64 offset, void const* data, u64 size) {
+		if (size == 0) return;
+		
+		gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, buf); // not part of any VAO
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+	}
+	static void copy_range (GLuint src, GLuint dst, u64 src_offset, u64 dst_offset, u64 size) {
+		if (size == 0) return;
+		
+		gl_state::bind_buffer(GL_COPY_READ_BUFFER, src);
+		gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, dst);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src_offset, dst_offset, size);
+	}
+	
+	// moves everything into new buffers of the given capacities, either at the same offsets or compacted to the front
+	void rebuild (u64 vert_capacity, u64 indx_capacity, bool compact) {
+		GLuint new_vert, new_indx;
+		glGenBuffers(1, &new_vert);
+		glGenBuffers(1, &new_indx);
+		
+		gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, new_vert);
+		glBufferData(GL_COPY_WRITE_BUFFER, vert_capacity * vertex_size, NULL, GL_STATIC_DRAW);
+		gl_state::bind_buffer(GL_COPY_WRITE_BUFFER, new_indx);
+		glBufferData(GL_COPY_WRITE_BUFFER, indx_capacity * sizeof(vert_indx_t), NULL, GL_STATIC_DRAW);
+		
+		if (compact) {
+			// indices are relative to the mesh vertices (base vertex), so both can move independently
+			auto sorted = allocations;
+			
+			std::sort(sorted.begin(), sorted.end(), [] (Allocation const* l, Allocation const* r) { return l->vert_begin < r->vert_begin; });
+			u64 pos = 0;
+			for (auto* a : sorted) {
+				copy_range(vbo_vert, new_vert, a->vert_begin * vertex_size, pos * vertex_size, a->vert_count * vertex_size);
+				a->vert_begin = pos;
+				pos += a->vert_count;
+			}
+			verts.capacity = vert_capacity;
+			verts.reset(pos);
+			
+			std::sort(sorted.begin(), sorted.end(), [] (Allocation const* l, Allocation const* r) { return l->indx_begin < r->indx_begin; });
+			pos = 0;
+			for (auto* a : sorted) {
+				copy_range(vbo_indx, new_indx, a->indx_begin * sizeof(vert_indx_t), pos * sizeof(vert_indx_t), a->indx_count * sizeof(vert_indx_t));
+				a->indx_begin = pos;
+				pos += a->indx_count;
+			}
+			indxs.capacity = indx_capacity;
+			indxs.reset(pos);
+		} else {
+			copy_range(vbo_vert, new_vert, 0, 0, verts.capacity * vertex_size);
+			copy_range(vbo_indx, new_indx, 0, 0, indxs.capacity * sizeof(vert_indx_t));
+			
+			verts.grow(vert_capacity);
+			indxs.grow(indx_capacity);
+		}
+		
+		gl_state::delete_buffer(vbo_vert); // 0 the first time, which is ignored
+		gl_state::delete_buffer(vbo_indx);
+		vbo_vert = new_vert;
+		vbo_indx = new_indx;
+		
+		if (!vao) glGenVertexArrays(1, &vao);
+		if (!vao_instanced) glGenVertexArrays(1, &vao_instanced);
+		
+		gl_state::bind_vertex_array(vao);
+		gl_state::bind_buffer(GL_ARRAY_BUFFER, vbo_vert);
+		layout->setup_attrib_arrays();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_indx);
+		
+		gl_state::bind_vertex_array(vao_instanced);
+		gl_state::bind_buffer(GL_ARRAY_BUFFER, vbo_vert);
+		layout->setup_attrib_arrays();
+		instancing::setup_attrib_arrays(); // pointers get set per draw
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_indx);
 	}
 };
 
+enum vbo_storage_e {
+	VBO_OWN_BUFFERS=0,	// respecified on every upload
+	VBO_STREAM,			// dynamic geometry that is uploaded every frame (text), suballocated from the stream_buffer
+	VBO_ARENA,			// static meshes, suballocated from the Geometry_Arena of the layout
+};
+
+// VBO_OWN_BUFFERS and VBO_STREAM have their own VAO, set up once in init() with the fixed attribute locations, so a draw is a single glBindVertexArray
+//  attributes the shader does not use are simply ignored
+//  VBO_STREAM has a second VAO for the stream_buffer, the own buffers are the fallback if it is full
 struct Vbo {
+	GLuint						vao;
 	GLuint						vbo_vert;
 	GLuint						vbo_indx;
 	std::vector<byte>			vertecies;
 	std::vector<vert_indx_t>	indices;
 	
-	Vertex_Layout*		layout;
+	Vertex_Layout*				layout;
+	vbo_storage_e				storage;
+	
+	GLuint						vao_stream;
+	bool						streamed; // last upload went into the stream_buffer, only valid for this frame
+	u32							streamed_base_vertex;
+	u64							streamed_indx_offset;
+	
+	Geometry_Arena::Allocation*	arena_alloc;
 	
 	bool format_is_indexed () {
 		return indices.size() > 0;
 	}
 	
-	void init (Vertex_Layout* l) {
+	void init (Vertex_Layout* l, vbo_storage_e s=VBO_OWN_BUFFERS) {
 		layout = l;
+		storage = s;
+		
+		vao = 0;
+		vbo_vert = 0;
+		vbo_indx = 0;
+		vao_stream = 0;
+		streamed = false;
+		arena_alloc = nullptr;
+		
+		if (storage == VBO_STREAM && !stream_buffer::buf) storage = VBO_OWN_BUFFERS;
 		
+		if (storage == VBO_ARENA) {
+			if (!layout->arena) layout->arena = new Geometry_Arena(layout);
+			return;
+		}
+		
+		glGenVertexArrays(1, &vao);
 		glGenBuffers(1, &vbo_vert);
 		glGenBuffers(1, &vbo_indx);
 		
+		setup_vao(vao, vbo_vert, vbo_indx);
+		
+		if (storage == VBO_STREAM) {
+			glGenVertexArrays(1, &vao_stream);
+			setup_vao(vao_stream, stream_buffer::buf, stream_buffer::buf); // offsets are given in the draw calls
+		}
+	}
+	void setup_vao (GLuint v, GLuint vert_buf, GLuint indx_buf) {
+		gl_state::bind_vertex_array(v);
+		
+		gl_state::bind_buffer(GL_ARRAY_BUFFER, vert_buf);
+		layout->setup_attrib_arrays();
+		
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indx_buf); // part of the VAO state
 	}
 	~Vbo () {
-		glDeleteBuffers(1, &vbo_vert);
-		glDeleteBuffers(1, &vbo_indx);
+		if (arena_alloc) layout->arena->free(arena_alloc);
+		
+		gl_state::delete_vertex_array(vao);
+		gl_state::delete_vertex_array(vao_stream);
+		gl_state::delete_buffer(vbo_vert);
+		gl_state::delete_buffer(vbo_indx);
 	}
 	
 	void clear () {
@@ -1383,7 +3350,24 @@ struct Vbo {
 	}
 	
 	void upload () {
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_vert);
+		render_stats::add(render_stats::ST_UPLOAD_BYTES, vector_size_bytes(vertecies) +(format_is_indexed() ? vector_size_bytes(indices) : 0));
+		
+		if (storage == VBO_ARENA) {
+			auto* arena = layout->arena;
+			if (arena_alloc) { // reupload after a hot reload
+				arena->free(arena_alloc);
+				arena->compact_if_fragmented();
+			}
+			arena_alloc = arena->alloc(vertecies, indices);
+			return;
+		}
+		
+		streamed = storage == VBO_STREAM && upload_stream();
+		if (streamed) return;
+		
+		gl_state::bind_vertex_array(vao); // binding the index buffer would change whatever VAO is bound
+		
+		gl_state::bind_buffer(GL_ARRAY_BUFFER, vbo_vert);
 		glBufferData(GL_ARRAY_BUFFER, vector_size_bytes(vertecies), NULL, GL_STATIC_DRAW);
 		glBufferData(GL_ARRAY_BUFFER, vector_size_bytes(vertecies), vertecies.data(), GL_STATIC_DRAW);
 		
@@ -1394,34 +3378,66 @@ struct Vbo {
 		}
 	}
 	
-	u32 bind (Shader const* shad) {
+	bool upload_stream () {
+		u32 vertex_size = layout->get_vertex_size();
 		
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_vert);
+		u64 vert_offset;
+		if (!stream_buffer::write(vertecies.data(), vector_size_bytes(vertecies), vertex_size, &vert_offset)) return false;
 		
-		u32 vertex_size = layout->bind_attrib_arrays(shad);
+		streamed_base_vertex = (u32)(vert_offset / vertex_size); // vertex_size aligned, so the draws can index from the start of the buffer
+		streamed_indx_offset = 0;
 		
 		if (format_is_indexed()) {
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_indx);
-		} else {
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			if (!stream_buffer::write(indices.data(), vector_size_bytes(indices), sizeof(vert_indx_t), &streamed_indx_offset)) return false;
 		}
-		
-		return vertex_size;
+		return true;
 	}
 	
-	void draw_entire (Shader const* shad) {
-		u32 vertex_size = bind(shad);
+	GLuint get_vao () {
+		if (storage == VBO_ARENA)	return layout->arena->vao;
+		else						return streamed ? vao_stream : vao;
+	}
+	void bind () {
+		if (storage == VBO_ARENA)	layout->arena->bind();
+		else						gl_state::bind_vertex_array(streamed ? vao_stream : vao);
+	}
+	
+	void draw_entire () {
+		bind();
+		
+		if (storage == VBO_ARENA) {
+			if (arena_alloc) layout->arena->draw(arena_alloc); // counts itself
+			return;
+		}
+		
+		u64 triangles = (format_is_indexed() ? indices.size() : vertecies.size() / layout->get_vertex_size()) / 3;
+		if (triangles > 0) render_stats::draw(triangles); // empty vbos draw nothing
+		
+		if (streamed) {
+			if (format_is_indexed()) {
+				glDrawElementsBaseVertex(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void*)streamed_indx_offset, streamed_base_vertex);
+			} else if (vertecies.size() > 0) {
+				glDrawArrays(GL_TRIANGLES, streamed_base_vertex, vertecies.size() / layout->get_vertex_size());
+			}
+			return;
+		}
 		
 		if (format_is_indexed()) {
 			if (indices.size() > 0)
 				glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, NULL);
 		} else {
 			if (vertecies.size() > 0) {
+				u32 vertex_size = layout->get_vertex_size();
 				dbg_assert(vertecies.size() % vertex_size == 0);
 				glDrawArrays(GL_TRIANGLES, 0, vertecies.size() / vertex_size);
 			}
 		}
 	}
+	// VBO_ARENA only, see Geometry_Arena::draw_instanced
+	void draw_instanced (u32 first_instance, u32 count) {
+		dbg_assert(storage == VBO_ARENA);
+		if (arena_alloc) layout->arena->draw_instanced(arena_alloc, first_instance, count);
+	}
 };
 
 static Shader* shad_equirectangular_to_cubemap;
@@ -0,0 +1,155 @@
+
+// GPU time per named scope, from GL_TIMESTAMP queries at the begin and end of each scope (unlike GL_TIME_ELAPSED they can nest)
+//  the queries of a frame are only read back FRAMES frames later, when the gpu is long done with them, so profiling never stalls
+//  if they are still not available the slot is busy and that frame is simply not profiled
+//  scope names have to be string literals (or otherwise outlive the results)
+namespace gpu_profiler {
+	static bool				enable =			true;
+	static bool				show_overlay =		false;
+	static bool				write_csv =			false; // one line per read back frame
+	static cstr				csv_filepath =		"gpu_profile.csv";
+	
+	static constexpr u32	FRAMES =			3;
+	static constexpr u32	MAX_SCOPES =		32; // per frame, including the frame scope
+	
+	struct Scope {
+		cstr		name;
+		u32			depth;
+	};
+	struct Frame {
+		GLuint				queries[MAX_SCOPES * 2]; // begin and end timestamp per scope
+		std::vector<Scope>	scopes; // [0] is the whole frame
+		std::vector<u32>	open; // scopes begun but not ended yet, (u32)-1 for scopes dropped because of MAX_SCOPES
+		u64					frame_i;
+		bool				pending; // queries issued, results not read back yet
+	};
+	struct Result {
+		cstr		name;
+		u32			depth;
+		f64			ms;
+	};
+	
+	static Frame			frames[FRAMES];
+	static Frame*			rec =				nullptr; // the frame being recorded
+	static bool				initialized =		false;
+	
+	static std::vector<Result>	results; // of the latest frame that was read back
+	static u64				results_frame =		0;
+	static u64				skipped_frames =	0; // because their slot was still busy
+	static u64				dropped_scopes =	0; // because of MAX_SCOPES
+	
+	static FILE*			csv_file =			nullptr;
+	static str				csv_header;
+	
+	static void init () {
+		for (auto& f : frames) {
+			glGenQueries(MAX_SCOPES * 2, f.queries);
+			f.pending = false;
+		}
+		initialized = true;
+	}
+	
+	static void append_csv () {
+		if (!csv_file) {
+			csv_file = fopen(csv_filepath, "w");
+			if (!csv_file) {
+				con_logf_warning("gpu_profiler: could not open \"%s\" for writing, csv disabled!", csv_filepath);
+				write_csv = false;
+				return;
+			}
+			csv_header.clear();
+		}
+		
+		str header = "frame";
+		for (auto& r : results) header += prints(",%s", r.name);
+		
+		if (header != csv_header) { // scopes differ from the last frame (eg. the depth prepass was toggled)
+			fprintf(csv_file, "%s\n", header.c_str());
+			csv_header = header;
+		}
+		
+		fprintf(csv_file, "%llu", results_frame);
+		for (auto& r : results) fprintf(csv_file, ",%.4f", r.ms);
+		fprintf(csv_file, "\n");
+	}
+	
+	static void read_back (Frame& f) {
+		results.clear();
+		
+		for (u32 i=0; i<(u32)f.scopes.size(); ++i) {
+			GLuint64 begin, end;
+			glGetQueryObjectui64v(f.queries[i*2 +0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(f.queries[i*2 +1], GL_QUERY_RESULT, &end);
+			
+			results.push_back({ f.scopes[i].name, f.scopes[i].depth, (f64)(end -begin) / 1000000 });
+		}
+		results_frame = f.frame_i;
+		
+		if (write_csv) append_csv();
+	}
+	
+	static void begin_scope (cstr name) {
+		if (!rec) return;
+		
+		if (rec->scopes.size() >= MAX_SCOPES) {
+			rec->open.push_back((u32)-1);
+			++dropped_scopes;
+			return;
+		}
+		
+		u32 i = (u32)rec->scopes.size();
+		rec->scopes.push_back({ name, (u32)rec->open.size() });
+		rec->open.push_back(i);
+		
+		glQueryCounter(rec->queries[i*2 +0], GL_TIMESTAMP);
+	}
+	static void end_scope () {
+		if (!rec) return;
+		
+		dbg_assert(rec->open.size() > 0, "gpu_profiler: end_scope without begin_scope");
+		u32 i = rec->open.back();
+		rec->open.pop_back();
+		
+		if (i != (u32)-1) glQueryCounter(rec->queries[i*2 +1], GL_TIMESTAMP);
+	}
+	
+	static void begin_frame (u64 frame_i) {
+		if (!write_csv && csv_file) {
+			fclose(csv_file);
+			csv_file = nullptr;
+		}
+		
+		rec = nullptr;
+		if (!enable) return;
+		if (!initialized) init();
+		
+		auto& f = frames[frame_i % FRAMES];
+		if (f.pending) {
+			GLuint available = 0;
+			glGetQueryObjectuiv(f.queries[0*2 +1], GL_QUERY_RESULT_AVAILABLE, &available); // the end of the frame scope is the last query of the frame
+			if (!available) {
+				++skipped_frames;
+				return;
+			}
+			
+			read_back(f);
+			f.pending = false;
+		}
+		
+		f.scopes.clear();
+		f.open.clear();
+		f.frame_i = frame_i;
+		
+		rec = &f;
+		begin_scope("frame");
+	}
+	static void end_frame () {
+		if (!rec) return;
+		
+		end_scope();
+		dbg_assert(rec->open.size() == 0, "gpu_profiler: %u scopes were not ended", (u32)rec->open.size());
+		
+		rec->pending = true;
+		rec = nullptr;
+	}
+}
@@ -0,0 +1,340 @@
+#include <emmintrin.h> // SSE2, always available on x64
+
+// Radiance .hdr (RGBE) loading straight into compact gpu hdr formats
+//  the rle scanlines get decoded into rgbe texels, which are then converted 4 at a time with SSE2 into the target format
+//  rgb9_e5 and r11g11b10f are 4 bytes per texel instead of 12 for rgb32f
+namespace hdr {
+	
+	enum format_e {
+		RGB9E5			=0,
+		R11G11B10F		,
+		RGB16F			,
+		RGB32F			,
+	};
+	
+	static u32 get_texel_size (format_e f) {
+		switch (f) {
+			case RGB9E5		:	return 4;
+			case R11G11B10F	:	return 4;
+			case RGB16F		:	return 3 * sizeof(u16);
+			case RGB32F		:	return 3 * sizeof(f32);
+			default: dbg_assert(false); return 0;
+		}
+	}
+	
+	static __m128i select (__m128i mask, __m128i a, __m128i b) { // mask ? a : b
+		return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+	}
+	
+	// 4 rgbe texels (r in the lowest byte) -> float r,g,b
+	static void rgbe_to_f32 (__m128i px, __m128* r, __m128* g, __m128* b) {
+		__m128i mask8 = _mm_set1_epi32(0xff);
+		
+		// m * 2^(e -128 -8) like stb_image, the float exponent bits of 2^(e -136) are (e -9) << 23, e <= 9 (which includes e == 0) gives 0
+		__m128i e = _mm_sub_epi32(_mm_srli_epi32(px, 24), _mm_set1_epi32(9));
+		e = _mm_and_si128(e, _mm_cmpgt_epi32(e, _mm_setzero_si128()));
+		__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+		
+		*r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(px, mask8)), scale);
+		*g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask8)), scale);
+		*b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask8)), scale);
+	}
+	
+	// unsigned float with a 5 bit exponent (bias 15) and mant_bits mantissa, like the components of r11g11b10f and half floats without sign
+	//  rounds to nearest, negative and nan become 0, too large values clamp to the largest finite value
+	static __m128i f32_to_small_float (__m128 f, s32 mant_bits) {
+		f = _mm_max_ps(f, _mm_setzero_ps()); // returns the second operand for nan
+		__m128i x = _mm_castps_si128(f);
+		
+		s32 shift = 23 -mant_bits;
+		
+		// rebias the exponent and round the mantissa, a carry out of the mantissa correctly increments the exponent
+		__m128i norm = _mm_sub_epi32(x, _mm_set1_epi32((127 -15) << 23));
+		norm = _mm_srl_epi32(_mm_add_epi32(norm, _mm_set1_epi32(1 << (shift -1))), _mm_cvtsi32_si128(shift));
+		
+		__m128i max_finite = _mm_set1_epi32((30 << mant_bits) | ((1 << mant_bits) -1));
+		norm = select(_mm_cmpgt_epi32(norm, max_finite), max_finite, norm);
+		
+		// below 2^-14 the result is a denormal: f / 2^-14 * 2^mant_bits
+		__m128i den = _mm_cvtps_epi32(_mm_mul_ps(f, _mm_set1_ps((f32)(1 << (14 +mant_bits)))));
+		__m128i is_den = _mm_cmplt_epi32(x, _mm_set1_epi32(113 << 23)); // 2^-14
+		
+		return select(is_den, den, norm);
+	}
+	
+	static __m128i pack_r11g11b10f (__m128 r, __m128 g, __m128 b) {
+		__m128i ri = f32_to_small_float(r, 6);
+		__m128i gi = f32_to_small_float(g, 6);
+		__m128i bi = f32_to_small_float(b, 5);
+		return _mm_or_si128(ri, _mm_or_si128(_mm_slli_epi32(gi, 11), _mm_slli_epi32(bi, 22)));
+	}
+	
+	// see EXT_texture_shared_exponent
+	static __m128i pack_rgb9e5 (__m128 r, __m128 g, __m128 b) {
+		__m128 zero = _mm_setzero_ps();
+		__m128 max_val = _mm_set1_ps(65408.0f); // (2^9 -1)/2^9 * 2^(31 -15)
+		__m128 half = _mm_set1_ps(0.5f);
+		
+		r = _mm_min_ps(_mm_max_ps(r, zero), max_val);
+		g = _mm_min_ps(_mm_max_ps(g, zero), max_val);
+		b = _mm_min_ps(_mm_max_ps(b, zero), max_val);
+		
+		__m128 m = _mm_max_ps(r, _mm_max_ps(g, b));
+		
+		// floor(log2(m)) from the exponent bits, clamped to -16, +1 +bias
+		__m128i e = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(m), 23), _mm_set1_epi32(127));
+		e = select(_mm_cmplt_epi32(e, _mm_set1_epi32(-16)), _mm_set1_epi32(-16), e);
+		e = _mm_add_epi32(e, _mm_set1_epi32(16));
+		
+		// 1 / 2^(e -15 -9)
+		__m128 inv_scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(24 +127), e), 23));
+		
+		__m128i maxm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(m, inv_scale), half));
+		
+		__m128i overflow = _mm_cmpeq_epi32(maxm, _mm_set1_epi32(512)); // rounding up to 2^9 needs one more exponent
+		e = _mm_sub_epi32(e, overflow);
+		inv_scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(24 +127), e), 23));
+		
+		__m128i ri = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, inv_scale), half));
+		__m128i gi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, inv_scale), half));
+		__m128i bi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, inv_scale), half));
+		
+		return _mm_or_si128(_mm_or_si128(ri, _mm_slli_epi32(gi, 9)), _mm_or_si128(_mm_slli_epi32(bi, 18), _mm_slli_epi32(e, 27)));
+	}
+	
+	// scalar unpacking for cpu side users of the data (ibl prefilter)
+	static f32 small_float_to_f32 (u32 v, s32 mant_bits) {
+		u32 e = v >> mant_bits;
+		u32 m = v & ((1u << mant_bits) -1);
+		
+		if (e == 0) return (f32)m * (1.0f / (f32)(1 << (14 +mant_bits))); // denormal
+		
+		u32 bits = ((e +127 -15) << 23) | (m << (23 -mant_bits));
+		f32 f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+	static v3 unpack_r11g11b10f (u32 v) {
+		return v3(small_float_to_f32(v & 0x7ff, 6), small_float_to_f32((v >> 11) & 0x7ff, 6), small_float_to_f32(v >> 22, 5));
+	}
+	static v3 unpack_rgb9e5 (u32 v) {
+		f32 scale = (f32)pow(2.0, (s32)(v >> 27) -15 -9);
+		return v3((f32)(v & 511), (f32)((v >> 9) & 511), (f32)((v >> 18) & 511)) * scale;
+	}
+	static f32 half_to_f32 (u16 h) {
+		dbg_assert((h & 0x8000) == 0); // we only produce positive halfs
+		return small_float_to_f32(h, 10);
+	}
+	
+	// stores count (<= 4) texels in format
+	static void store_texels (__m128 r, __m128 g, __m128 b, u32 count, format_e format, byte* dst) {
+		switch (format) {
+			case RGB9E5: case R11G11B10F: {
+				__m128i packed = format == RGB9E5 ? pack_rgb9e5(r, g, b) : pack_r11g11b10f(r, g, b);
+				if (count == 4)	_mm_storeu_si128((__m128i*)dst, packed);
+				else {
+					u32 tmp[4];
+					_mm_storeu_si128((__m128i*)tmp, packed);
+					memcpy(dst, tmp, count * 4);
+				}
+			} break;
+			
+			case RGB16F: {
+				u32 h[3][4];
+				_mm_storeu_si128((__m128i*)h[0], f32_to_small_float(r, 10));
+				_mm_storeu_si128((__m128i*)h[1], f32_to_small_float(g, 10));
+				_mm_storeu_si128((__m128i*)h[2], f32_to_small_float(b, 10));
+				
+				u16* out = (u16*)dst;
+				for (u32 i=0; i<count; ++i) {
+					out[i*3 +0] = (u16)h[0][i];
+					out[i*3 +1] = (u16)h[1][i];
+					out[i*3 +2] = (u16)h[2][i];
+				}
+			} break;
+			
+			case RGB32F: {
+				// transpose rrrr gggg bbbb -> rgb rgb rgb rgb
+				f32 f[3][4];
+				_mm_storeu_ps(f[0], r);
+				_mm_storeu_ps(f[1], g);
+				_mm_storeu_ps(f[2], b);
+				
+				f32* out = (f32*)dst;
+				for (u32 i=0; i<count; ++i) {
+					out[i*3 +0] = f[0][i];
+					out[i*3 +1] = f[1][i];
+					out[i*3 +2] = f[2][i];
+				}
+			} break;
+			
+			default: dbg_assert(false);
+		}
+	}
+	
+	// converts one row of rgbe texels, rgbe needs to be readable up to the next multiple of 4 texels
+	static void convert_row (u32 const* rgbe, u32 w, format_e format, byte* dst) {
+		u32 texel_size = get_texel_size(format);
+		
+		for (u32 x=0; x<w; x+=4) {
+			__m128 r, g, b;
+			rgbe_to_f32(_mm_loadu_si128((__m128i const*)(rgbe +x)), &r, &g, &b);
+			
+			store_texels(r, g, b, min(w -x, (u32)4), format, dst +x * texel_size);
+		}
+	}
+	
+	// averages the rgbe texels in the boxes of downsample::get_box into one row of w texels in format
+	static void convert_row_downsampled (u32 const* rgbe, iv2 src_dim, s32 y, u32 levels, u32 w, format_e format, byte* dst) {
+		s32 y0, y1;
+		downsample::get_box(y, levels, src_dim.y, &y0, &y1);
+		
+		std::vector<f32> sum ((u64)(w +4) * 3, 0); // +4 texels so we can always read 4
+		
+		for (s32 sy=y0; sy<y1; ++sy) {
+			u32 const* row = rgbe +(u64)sy * src_dim.x;
+			
+			u32 src_w = min((u32)src_dim.x, w << levels);
+			for (u32 x=0; x<src_w; x+=4) {
+				f32 f[3][4];
+				__m128 r, g, b;
+				rgbe_to_f32(_mm_loadu_si128((__m128i const*)(row +x)), &r, &g, &b);
+				_mm_storeu_ps(f[0], r);
+				_mm_storeu_ps(f[1], g);
+				_mm_storeu_ps(f[2], b);
+				
+				u32 count = min(src_w -x, (u32)4);
+				for (u32 i=0; i<count; ++i) {
+					f32* s = &sum[((x +i) >> levels) * 3];
+					s[0] += f[0][i];
+					s[1] += f[1][i];
+					s[2] += f[2][i];
+				}
+			}
+		}
+		
+		u32 texel_size = get_texel_size(format);
+		
+		for (u32 x=0; x<w; x+=4) {
+			f32 const* s = &sum[x * 3];
+			__m128 r = _mm_setr_ps(s[0], s[3], s[6], s[ 9]);
+			__m128 g = _mm_setr_ps(s[1], s[4], s[7], s[10]);
+			__m128 b = _mm_setr_ps(s[2], s[5], s[8], s[11]);
+			
+			f32 inv_count[4];
+			for (u32 i=0; i<4; ++i) {
+				s32 x0, x1;
+				downsample::get_box((s32)(x +i), levels, src_dim.x, &x0, &x1);
+				inv_count[i] = x1 > x0 ? 1.0f / (f32)((y1 -y0) * (x1 -x0)) : 0;
+			}
+			__m128 scale = _mm_loadu_ps(inv_count);
+			
+			store_texels(_mm_mul_ps(r, scale), _mm_mul_ps(g, scale), _mm_mul_ps(b, scale), min(w -x, (u32)4), format, dst +x * texel_size);
+		}
+	}
+	
+	static bool read_line (byte const** cur, byte const* end, str* line) {
+		byte const* begin = *cur;
+		while (*cur < end && **cur != '\n') ++(*cur);
+		if (*cur == end) return false;
+		
+		line->assign((char const*)begin, *cur -begin);
+		++(*cur); // skip newline
+		return true;
+	}
+	
+	// decodes the scanlines of a .hdr file into rgbe texels, top row first like in the file
+	static bool read_rgbe (byte const* file, u64 file_size, iv2* dim, std::vector<u32>* rgbe) {
+		byte const* cur = file;
+		byte const* end = file +file_size;
+		
+		str line;
+		if (!read_line(&cur, end, &line) || line.compare(0, 2, "#?") != 0) return false;
+		
+		for (;;) {
+			if (!read_line(&cur, end, &line)) return false;
+			if (line.size() == 0) break; // end of header
+			
+			if (line.compare(0, 7, "FORMAT=") == 0 && line.compare("FORMAT=32-bit_rle_rgbe") != 0) return false; // xyze not supported
+		}
+		
+		if (!read_line(&cur, end, &line)) return false;
+		
+		s32 w, h;
+		if (sscanf(line.c_str(), "-Y %d +X %d", &h, &w) != 2 || w <= 0 || h <= 0) return false; // other orientations not supported
+		
+		*dim = iv2(w, h);
+		
+		rgbe->resize((u64)w * h +4); // +4 so convert_row can always read 4 texels
+		
+		for (s32 y=0; y<h; ++y) {
+			byte* row = (byte*)&(*rgbe)[(u64)y * w];
+			
+			bool rle = w >= 8 && w < 0x8000 && end -cur >= 4 && cur[0] == 2 && cur[1] == 2 && (cur[2] & 0x80) == 0;
+			if (!rle) { // flat scanlines (the whole rest of the file is flat then)
+				u64 size = (u64)w * 4;
+				if ((u64)(end -cur) < size) return false;
+				
+				memcpy(row, cur, size);
+				cur += size;
+				continue;
+			}
+			
+			if (((s32)cur[2] << 8 | cur[3]) != w) return false;
+			cur += 4;
+			
+			// each component is run length encoded separately
+			for (u32 c=0; c<4; ++c) {
+				s32 x = 0;
+				while (x < w) {
+					if (cur == end) return false;
+					u32 count = *cur++;
+					
+					if (count > 128) { // run
+						count -= 128;
+						if (cur == end || x +(s32)count > w) return false;
+						
+						byte val = *cur++;
+						for (u32 i=0; i<count; ++i) row[(x++) * 4 +c] = val;
+					} else { // literals
+						if (count == 0 || (u64)(end -cur) < count || x +(s32)count > w) return false;
+						
+						for (u32 i=0; i<count; ++i) row[(x++) * 4 +c] = *cur++;
+					}
+				}
+			}
+		}
+		
+		return true;
+	}
+	
+	// loads a .hdr file in format, bottom row first like OpenGL wants it
+	//  images larger than max_dim get box downsampled by powers of two (while still in float), levels returns how often it was halved
+	static bool load (cstr filepath, format_e format, iv2 max_dim, iv2* dim, Data_Block* data, u32* levels) {
+		Data_Block file;
+		if (!read_entire_file(filepath, &file)) return false;
+		defer { file.free(); };
+		
+		iv2 src_dim;
+		std::vector<u32> rgbe;
+		if (!read_rgbe(file.data, file.size, &src_dim, &rgbe)) return false;
+		
+		*levels = downsample::get_levels(src_dim, max_dim);
+		*dim = downsample::get_dim(src_dim, *levels);
+		
+		u64 stride = (u64)dim->x * get_texel_size(format);
+		*data = Data_Block::alloc((u64)dim->y * stride);
+		
+		s32 w = dim->x;
+		s32 h = dim->y;
+		u32 l = *levels;
+		parallel_for((u32)h, [&] (u32 y) {
+			byte* dst = data->data +(u64)(h -1 -y) * stride;
+			
+			if (l == 0)	convert_row(&rgbe[(u64)y * w], (u32)w, format, dst);
+			else		convert_row_downsampled(rgbe.data(), src_dim, (s32)y, l, (u32)w, format, dst);
+		}, l == 0 ? 16 : 1);
+		
+		return true;
+	}
+}
@@ -0,0 +1,641 @@
+
+#include <emmintrin.h> // SSE2, always available on x64
+
+// CPU prefiltering of environment cubemaps for image based lighting
+//  -diffuse: irradiance projected into 9 SH coefficients
+//  -specular: GGX convolved cubemap, one roughness per mip, importance sampled
+// results are cached in asset_cache_path keyed by the source file versions, so this only runs when the source changes
+namespace ibl {
+	
+	static constexpr u32 CACHE_VERSION = 2; // 2: hdr sources are r11g11b10f now
+	
+	static f32 srgb8_to_linear[256];
+	
+	static void init_srgb8_to_linear () {
+		static bool done = false;
+		if (done) return;
+		
+		for (u32 i=0; i<256; ++i) srgb8_to_linear[i] = to_linear((f32)i / 255.0f);
+		done = true;
+	}
+	
+	static v4 load_texel (pixel_type type, byte const* p) {
+		switch (type) {
+			case PT_SRGB8_LA8	:
+			case PT_SRGB8		:	return v4(srgb8_to_linear[p[0]], srgb8_to_linear[p[1]], srgb8_to_linear[p[2]], 0);
+			case PT_LRGBA8		:
+			case PT_LRGB8		:	return v4((f32)p[0] / 255, (f32)p[1] / 255, (f32)p[2] / 255, 0);
+			case PT_LR8			:	return v4(v3((f32)p[0] / 255), 0);
+			
+			case PT_LRGBA32F	:
+			case PT_LRGB32F		: {
+				auto* f = (f32 const*)p;
+				return v4(f[0], f[1], f[2], 0);
+			}
+			
+			case PT_LRGB16F		: {
+				auto* h = (u16 const*)p;
+				return v4(hdr::half_to_f32(h[0]), hdr::half_to_f32(h[1]), hdr::half_to_f32(h[2]), 0);
+			}
+			case PT_LR11G11B10F	:	return v4(hdr::unpack_r11g11b10f(*(u32 const*)p), 0);
+			case PT_LRGB9E5		:	return v4(hdr::unpack_rgb9e5(*(u32 const*)p), 0);
+			
+			default: dbg_assert(false, "pixel type %d not supported as ibl prefilter source", type); return 0;
+		}
+	}
+	
+	// GL cubemap face selection, see 'Cube Map Texture Selection' in the GL spec
+	//  st is in [0,1] with (0,0) at the first texel in memory
+	static u32 dir_to_face_st (v3 d, v2* st) {
+		v3 a = v3(abs(d.x), abs(d.y), abs(d.z));
+		
+		u32 face;
+		f32 sc, tc, ma;
+		if (a.x >= a.y && a.x >= a.z) {
+			ma = a.x;
+			if (d.x > 0) {	face = 0;	sc = -d.z;	tc = -d.y; }
+			else {			face = 1;	sc = +d.z;	tc = -d.y; }
+		} else if (a.y >= a.z) {
+			ma = a.y;
+			if (d.y > 0) {	face = 2;	sc = +d.x;	tc = +d.z; }
+			else {			face = 3;	sc = +d.x;	tc = -d.z; }
+		} else {
+			ma = a.z;
+			if (d.z > 0) {	face = 4;	sc = +d.x;	tc = -d.y; }
+			else {			face = 5;	sc = -d.x;	tc = -d.y; }
+		}
+		
+		*st = v2(sc / ma, tc / ma) * 0.5f +0.5f;
+		return face;
+	}
+	static v3 face_st_to_dir (u32 face, v2 st) {
+		f32 sc = st.x * 2 -1;
+		f32 tc = st.y * 2 -1;
+		
+		v3 d;
+		switch (face) {
+			case 0:	d = v3(+1, -tc, -sc);	break;
+			case 1:	d = v3(-1, -tc, +sc);	break;
+			case 2:	d = v3(+sc, +1, +tc);	break;
+			case 3:	d = v3(+sc, -1, -tc);	break;
+			case 4:	d = v3(+sc, -tc, +1);	break;
+			case 5:	d = v3(-sc, -tc, -1);	break;
+			default: dbg_assert(false); d = 0;
+		}
+		return normalize(d);
+	}
+	static v3 texel_dir (u32 face, s32 x, s32 y, s32 res) {
+		return face_st_to_dir(face, (v2((f32)x,(f32)y) +0.5f) / (f32)res);
+	}
+	
+	// solid angle of a cubemap texel, from the projected area of the texel corners onto the unit sphere
+	static f32 area_element (f32 x, f32 y) {
+		return atan2(x * y, sqrt(x*x +y*y +1));
+	}
+	static f32 texel_solid_angle (s32 x, s32 y, s32 res) {
+		f32 inv_res = 1.0f / (f32)res;
+		
+		f32 x0 = (f32)(x +0) * 2 * inv_res -1;
+		f32 x1 = (f32)(x +1) * 2 * inv_res -1;
+		f32 y0 = (f32)(y +0) * 2 * inv_res -1;
+		f32 y1 = (f32)(y +1) * 2 * inv_res -1;
+		
+		return area_element(x0,y0) -area_element(x0,y1) -area_element(x1,y0) +area_element(x1,y1);
+	}
+	
+	// linear float cubemap with a box filtered mip chain, rgb +padding so every texel is one sse load
+	struct Env_Cube {
+		struct Mip {
+			s32					res;
+			std::vector<v4>		texels; // [face][y][x]
+			
+			v4 const* face (u32 face_i) const {	return &texels[(u64)face_i * res * res]; }
+		};
+		
+		std::vector<Mip>	mips;
+		
+		void alloc (s32 res) {
+			mips.clear();
+			for (;;) {
+				mips.emplace_back();
+				mips.back().res = res;
+				mips.back().texels.resize(6 * (u64)res * res);
+				
+				if (res == 1) break;
+				res /= 2;
+			}
+		}
+		
+		void gen_mips () {
+			for (u32 i=1; i<(u32)mips.size(); ++i) {
+				auto& src = mips[i -1];
+				auto& dst = mips[i];
+				
+				parallel_for(6 * dst.res, [&] (u32 row) {
+					u32 face_i = row / dst.res;
+					s32 y = row % dst.res;
+					
+					v4 const* s = src.face(face_i);
+					v4* d = &dst.texels[(u64)face_i * dst.res * dst.res];
+					
+					for (s32 x=0; x<dst.res; ++x) {
+						__m128 a = _mm_loadu_ps(&s[(y*2 +0) * src.res +(x*2 +0)].x);
+						__m128 b = _mm_loadu_ps(&s[(y*2 +0) * src.res +(x*2 +1)].x);
+						__m128 c = _mm_loadu_ps(&s[(y*2 +1) * src.res +(x*2 +0)].x);
+						__m128 e = _mm_loadu_ps(&s[(y*2 +1) * src.res +(x*2 +1)].x);
+						
+						__m128 avg = _mm_mul_ps(_mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, e)), _mm_set1_ps(0.25f));
+						_mm_storeu_ps(&d[y * dst.res +x].x, avg);
+					}
+				});
+			}
+		}
+		
+		__m128 sample_bilinear (u32 mip_i, u32 face_i, v2 st) const {
+			auto& m = mips[mip_i];
+			v4 const* f = m.face(face_i);
+			
+			f32 fx = clamp(st.x * m.res -0.5f, 0.0f, (f32)(m.res -1));
+			f32 fy = clamp(st.y * m.res -0.5f, 0.0f, (f32)(m.res -1));
+			
+			s32 x0 = (s32)fx;
+			s32 y0 = (s32)fy;
+			s32 x1 = min(x0 +1, m.res -1);
+			s32 y1 = min(y0 +1, m.res -1);
+			
+			__m128 tx = _mm_set1_ps(fx -(f32)x0);
+			__m128 ty = _mm_set1_ps(fy -(f32)y0);
+			
+			__m128 a = _mm_loadu_ps(&f[y0 * m.res +x0].x);
+			__m128 b = _mm_loadu_ps(&f[y0 * m.res +x1].x);
+			__m128 c = _mm_loadu_ps(&f[y1 * m.res +x0].x);
+			__m128 d = _mm_loadu_ps(&f[y1 * m.res +x1].x);
+			
+			__m128 ab = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), tx));
+			__m128 cd = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), tx));
+			return _mm_add_ps(ab, _mm_mul_ps(_mm_sub_ps(cd, ab), ty));
+		}
+		__m128 sample_trilinear (v3 dir, f32 lod) const {
+			v2 st;
+			u32 face_i = dir_to_face_st(dir, &st);
+			
+			lod = clamp(lod, 0.0f, (f32)(mips.size() -1));
+			
+			u32 l0 = (u32)lod;
+			u32 l1 = min(l0 +1, (u32)mips.size() -1);
+			
+			__m128 a = sample_bilinear(l0, face_i, st);
+			if (l0 == l1) return a;
+			
+			__m128 b = sample_bilinear(l1, face_i, st);
+			return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(lod -(f32)l0)));
+		}
+	};
+	
+	// same mapping as equirectangular_to_cubemap.frag, so the cpu path sees the same cubemap as the gpu conversion
+	static v2 cubemap_dir_to_equirectangular_uv (v3 dir) {
+		return v2(	-(atan2(dir.y, dir.x) +PI/2) / (PI*2),
+					-atan2(length(dir.xy()), dir.z) / PI );
+	}
+	
+	static v4 sample_equirect_bilinear (Texture2D const* tex, v3 dir) {
+		auto& m = tex->mips[0];
+		u32 pixel_size = (u32)(m.stride / (u64)m.dim.x);
+		
+		v2 uv = cubemap_dir_to_equirectangular_uv(dir);
+		uv.x -= floor(uv.x); // GL_REPEAT
+		uv.y -= floor(uv.y);
+		
+		f32 fx = uv.x * m.dim.x -0.5f;
+		f32 fy = clamp(uv.y * m.dim.y -0.5f, 0.0f, (f32)(m.dim.y -1));
+		
+		s32 x0 = (s32)floor(fx);
+		s32 y0 = (s32)fy;
+		f32 tx = fx -(f32)x0;
+		f32 ty = fy -(f32)y0;
+		
+		s32 x1 = x0 +1;
+		s32 y1 = min(y0 +1, m.dim.y -1);
+		x0 = mymod(x0, m.dim.x);
+		x1 = mymod(x1, m.dim.x);
+		
+		auto texel = [&] (s32 x, s32 y) {
+			return load_texel(tex->type, m.data +(u64)y * m.stride +(u64)x * pixel_size);
+		};
+		
+		return lerp(lerp(texel(x0,y0), texel(x1,y0), tx), lerp(texel(x0,y1), texel(x1,y1), tx), ty);
+	}
+	
+	// builds mip 0 of the env at res from the source cubemap faces (box filter) or equirectangular image (2x2 supersampled)
+	static bool build_env_cube (TextureCube* src, s32 res, Env_Cube* env) {
+		env->alloc(res);
+		auto& m0 = env->mips[0];
+		
+		Texture2D* equirect = src->get_equirect();
+		
+		if (equirect) {
+			if (equirect->mips.size() < 1 || !equirect->mips[0].data) return false;
+			
+			parallel_for(6 * res, [&] (u32 row) {
+				u32 face_i = row / res;
+				s32 y = row % res;
+				
+				v4* d = &m0.texels[(u64)face_i * res * res];
+				
+				for (s32 x=0; x<res; ++x) {
+					v4 sum = 0;
+					for (u32 j=0; j<2; ++j) {
+						for (u32 i=0; i<2; ++i) {
+							v2 st = (v2((f32)x,(f32)y) +v2(0.25f +0.5f*i, 0.25f +0.5f*j)) / (f32)res;
+							sum += sample_equirect_bilinear(equirect, face_st_to_dir(face_i, st));
+						}
+					}
+					d[y * res +x] = sum * 0.25f;
+				}
+			});
+		} else {
+			if (src->mips.size() < 1 || !src->mips[0].data) return false;
+			
+			auto& sm = src->mips[0];
+			u32 pixel_size = (u32)(sm.stride / (u64)sm.dim.x);
+			
+			parallel_for(6 * res, [&] (u32 row) {
+				u32 face_i = row / res;
+				s32 y = row % res;
+				
+				byte const* sface = sm.data +face_i * sm.face_size;
+				v4* d = &m0.texels[(u64)face_i * res * res];
+				
+				s32 sy0 = (y +0) * sm.dim.y / res;
+				s32 sy1 = max((y +1) * sm.dim.y / res, sy0 +1);
+				
+				for (s32 x=0; x<res; ++x) {
+					s32 sx0 = (x +0) * sm.dim.x / res;
+					s32 sx1 = max((x +1) * sm.dim.x / res, sx0 +1);
+					
+					v4 sum = 0;
+					for (s32 sy=sy0; sy<sy1; ++sy) {
+						for (s32 sx=sx0; sx<sx1; ++sx) {
+							sum += load_texel(src->type, sface +(u64)sy * sm.stride +(u64)sx * pixel_size);
+						}
+					}
+					d[y * res +x] = sum / (f32)((sy1 -sy0) * (sx1 -sx0));
+				}
+			});
+		}
+		
+		env->gen_mips();
+		return true;
+	}
+	
+	//// SH irradiance
+	static void sh9_basis (v3 d, f32* out) {
+		out[0] = 0.282095f;
+		
+		out[1] = 0.488603f * d.y;
+		out[2] = 0.488603f * d.z;
+		out[3] = 0.488603f * d.x;
+		
+		out[4] = 1.092548f * d.x * d.y;
+		out[5] = 1.092548f * d.y * d.z;
+		out[6] = 0.315392f * (3 * d.z * d.z -1);
+		out[7] = 1.092548f * d.x * d.z;
+		out[8] = 0.546274f * (d.x * d.x -d.y * d.y);
+	}
+	
+	// projects the env radiance into SH and convolves with the clamped cosine lobe
+	//  -> result evaluated with eval_sh9 gives irradiance, divide by PI for lambert diffuse
+	static void project_sh9_irradiance (Env_Cube const& env, v3* sh) {
+		u32 mip_i = 0; // 64^2 per face is plenty for 3 bands
+		while (env.mips[mip_i].res > 64) ++mip_i;
+		
+		auto& m = env.mips[mip_i];
+		
+		struct Row_Sum {
+			__m128	c[9];
+		};
+		std::vector<Row_Sum> rows (6 * m.res);
+		
+		parallel_for(6 * m.res, [&] (u32 row) {
+			u32 face_i = row / m.res;
+			s32 y = row % m.res;
+			
+			v4 const* f = m.face(face_i);
+			
+			__m128 c[9];
+			for (u32 k=0; k<9; ++k) c[k] = _mm_setzero_ps();
+			
+			for (s32 x=0; x<m.res; ++x) {
+				f32 basis[9];
+				sh9_basis(texel_dir(face_i, x, y, m.res), basis);
+				
+				__m128 col = _mm_mul_ps(_mm_loadu_ps(&f[y * m.res +x].x), _mm_set1_ps(texel_solid_angle(x, y, m.res)));
+				
+				for (u32 k=0; k<9; ++k) c[k] = _mm_add_ps(c[k], _mm_mul_ps(col, _mm_set1_ps(basis[k])));
+			}
+			
+			for (u32 k=0; k<9; ++k) rows[row].c[k] = c[k];
+		});
+		
+		// reduce serially so the result does not depend on thread scheduling
+		f64 total[9][4] = {};
+		for (auto& r : rows) {
+			for (u32 k=0; k<9; ++k) {
+				f32 tmp[4];
+				_mm_storeu_ps(tmp, r.c[k]);
+				for (u32 i=0; i<3; ++i) total[k][i] += tmp[i];
+			}
+		}
+		
+		static constexpr f32 A[9] = { // cosine lobe convolution per band
+			PI,
+			2*PI/3, 2*PI/3, 2*PI/3,
+			PI/4, PI/4, PI/4, PI/4, PI/4,
+		};
+		for (u32 k=0; k<9; ++k) {
+			sh[k] = v3((f32)total[k][0], (f32)total[k][1], (f32)total[k][2]) * A[k];
+		}
+	}
+	
+	static v3 eval_sh9 (v3 const* sh, v3 dir) {
+		f32 basis[9];
+		sh9_basis(dir, basis);
+		
+		v3 ret = 0;
+		for (u32 k=0; k<9; ++k) ret += sh[k] * basis[k];
+		return ret;
+	}
+	
+	//// GGX specular
+	static f32 radical_inverse_vdc (u32 bits) {
+		bits = (bits << 16) | (bits >> 16);
+		bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+		bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+		bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+		bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+		return (f32)bits * 2.3283064365386963e-10f; // / 0x100000000
+	}
+	
+	struct GGX_Sample {
+		v3		L_tang; // light dir in tangent space of N (V == N)
+		f32		NdotL;
+		f32		lod; // source mip to sample from, from the sample pdf (filtered importance sampling)
+	};
+	
+	static std::vector<GGX_Sample> gen_ggx_samples (f32 roughness, u32 count, s32 env_res) {
+		std::vector<GGX_Sample> samples;
+		samples.reserve(count);
+		
+		f32 a = roughness * roughness;
+		f32 a2 = a * a;
+		
+		f32 texel_sa = 4*PI / (6 * (f32)env_res * (f32)env_res);
+		
+		for (u32 i=0; i<count; ++i) {
+			v2 xi = v2((f32)i / (f32)count, radical_inverse_vdc(i));
+			
+			f32 phi = 2*PI * xi.x;
+			f32 cos_theta = sqrt((1 -xi.y) / (1 +(a2 -1) * xi.y));
+			f32 sin_theta = sqrt(1 -cos_theta * cos_theta);
+			
+			v3 H = v3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+			v3 L = 2 * H.z * H -v3(0,0,1);
+			
+			if (L.z <= 0) continue;
+			
+			f32 NdotH = H.z;
+			f32 d = NdotH * NdotH * (a2 -1) +1;
+			f32 D = a2 / (PI * d * d);
+			f32 pdf = D * 0.25f; // D * NdotH / (4 * VdotH) with N == V
+			
+			f32 sample_sa = 1.0f / ((f32)count * pdf +0.0001f);
+			f32 lod = max(0.5f * log2(sample_sa / texel_sa) +1, 0.0f);
+			
+			samples.push_back({ L, L.z, lod });
+		}
+		return samples;
+	}
+	
+	static void prefilter_ggx_mip (Env_Cube const& env, f32 roughness, u32 sample_count, s32 res, f32* out) {
+		
+		std::vector<GGX_Sample> samples;
+		if (roughness > 0) samples = gen_ggx_samples(roughness, sample_count, env.mips[0].res);
+		
+		f32 mirror_lod = log2((f32)env.mips[0].res / (f32)res);
+		
+		parallel_for(6 * res, [&] (u32 row) {
+			u32 face_i = row / res;
+			s32 y = row % res;
+			
+			f32* d = out +((u64)face_i * res * res +(u64)y * res) * 3;
+			
+			for (s32 x=0; x<res; ++x) {
+				v3 N = texel_dir(face_i, x, y, res);
+				
+				__m128 col;
+				if (samples.size() == 0) {
+					col = env.sample_trilinear(N, mirror_lod);
+				} else {
+					v3 up = abs(N.z) < 0.999f ? v3(0,0,1) : v3(1,0,0);
+					v3 T = normalize(cross(up, N));
+					v3 B = cross(N, T);
+					
+					__m128 sum = _mm_setzero_ps();
+					f32 total_w = 0;
+					
+					for (auto& s : samples) {
+						v3 L = T * s.L_tang.x +B * s.L_tang.y +N * s.L_tang.z;
+						
+						sum = _mm_add_ps(sum, _mm_mul_ps(env.sample_trilinear(L, s.lod), _mm_set1_ps(s.NdotL)));
+						total_w += s.NdotL;
+					}
+					col = _mm_mul_ps(sum, _mm_set1_ps(1.0f / total_w));
+				}
+				
+				f32 tmp[4];
+				_mm_storeu_ps(tmp, col);
+				*d++ = tmp[0];
+				*d++ = tmp[1];
+				*d++ = tmp[2];
+			}
+		});
+	}
+	
+	//// disk cache
+	struct Cache_Header {
+		char	magic[4];
+		u32		version;
+		u64		key;
+		u32		spec_res;
+		u32		mip_count;
+		v3		sh[9];
+	};
+	
+	static str get_cache_filepath (u64 key) {
+		return prints("%sibl_%016llx.bin", asset_cache_path, key);
+	}
+}
+
+struct Prefiltered_Env {
+	str				name;
+	TextureCube*	src;
+	
+	u32				spec_res;
+	u32				sample_count;
+	
+	u64				key; // key of the source version the current data was computed from, 0 if not computed yet
+	
+	v3				sh_irradiance[9]; // irradiance in SH (already convolved with the cosine lobe), see ibl::eval_sh9
+	TextureCube		specular; // GGX prefiltered radiance, mip i has roughness i/(mips -1)
+	
+	Prefiltered_Env (strcr n, TextureCube* s, u32 res, u32 samples): name{n}, src{s}, spec_res{res}, sample_count{samples}, key{0} {
+		for (auto& c : sh_irradiance) c = 0;
+	}
+	
+	v3 eval_irradiance (v3 dir_cubemap) {
+		return ibl::eval_sh9(sh_irradiance, dir_cubemap);
+	}
+	
+	f32 get_mip_roughness (u32 mip_i) {
+		return specular.mips.size() <= 1 ? 0 : (f32)mip_i / (f32)(specular.mips.size() -1);
+	}
+	
+	bool update () {
+		u64 src_key = src->get_source_key();
+		key = src_key; // also on failure, so we only retry once the source changes
+		
+		u64 k = src_key;
+		k = hash_fnv1a(&spec_res, sizeof(spec_res), k);
+		k = hash_fnv1a(&sample_count, sizeof(sample_count), k);
+		k = hash_fnv1a(&ibl::CACHE_VERSION, sizeof(ibl::CACHE_VERSION), k);
+		
+		f64 begin;
+		if (1) {
+			con_logf("Prefiltering environment '%s'...", name.c_str());
+			if (startup) draw_loadinscreen_frame();
+			
+			begin = glfwGetTime();
+		}
+		
+		bool cached = load_cache(k);
+		if (!cached) {
+			if (!prefilter()) {
+				con_logf_warning("environment '%s' could not be prefiltered, source not loaded!", name.c_str());
+				return false;
+			}
+			write_cache(k);
+		}
+		
+		specular.upload();
+		
+		if (1) {
+			auto dt = glfwGetTime() -begin;
+			con_logf(">>> %f ms%s", dt * 1000, cached ? " (cached)" : "");
+		}
+		return true;
+	}
+	
+	bool reload_if_needed () {
+		if (src->get_source_key() == key) return false;
+		return update();
+	}
+
+private:
+	void alloc_specular (u32 mip_count) {
+		specular.type = PT_LRGB32F;
+		specular.dim = (s32)spec_res;
+		specular.mips.resize(mip_count);
+		
+		u64 total = 0;
+		for (u32 i=0; i<mip_count; ++i) {
+			u64 res = max(spec_res >> i, (u32)1);
+			total += 6 * res*res * 3*sizeof(f32);
+		}
+		
+		specular.data.free();
+		specular.data = Data_Block::alloc(total);
+		
+		byte* cur = specular.data.data;
+		for (u32 i=0; i<mip_count; ++i) {
+			s32 res = (s32)max(spec_res >> i, (u32)1);
+			u64 stride = (u64)res * 3*sizeof(f32);
+			u64 face_size = (u64)res * stride;
+			
+			specular.mips[i] = { cur, 6 * face_size, iv2(res), stride, face_size };
+			cur += 6 * face_size;
+		}
+	}
+	
+	bool prefilter () {
+		ibl::init_srgb8_to_linear();
+		
+		s32 src_res;
+		if (src->get_equirect())	src_res = src->get_equirect()->dim.x / 4;
+		else						src_res = src->dim.x;
+		
+		s32 env_res = (s32)spec_res * 2;
+		while (env_res > src_res && env_res > 1) env_res /= 2;
+		
+		ibl::Env_Cube env;
+		if (!ibl::build_env_cube(src, env_res, &env)) return false;
+		
+		ibl::project_sh9_irradiance(env, sh_irradiance);
+		
+		u32 mip_count = 1;
+		while ((spec_res >> (mip_count -1)) > 1) ++mip_count; // full chain down to 1x1
+		
+		alloc_specular(mip_count);
+		
+		for (u32 i=0; i<mip_count; ++i) {
+			auto& m = specular.mips[i];
+			ibl::prefilter_ggx_mip(env, get_mip_roughness(i), sample_count, m.dim.x, (f32*)m.data);
+		}
+		return true;
+	}
+	
+	bool load_cache (u64 k) {
+		auto filepath = ibl::get_cache_filepath(k);
+		
+		FILE* f = fopen(filepath.c_str(), "rb");
+		if (!f) return false;
+		
+		defer { fclose(f); };
+		
+		ibl::Cache_Header h;
+		if (fread(&h, 1,sizeof(h), f) != sizeof(h)) return false;
+		
+		if (	memcmp(h.magic, "IBL ", 4) != 0 || h.version != ibl::CACHE_VERSION ||
+				h.key != k || h.spec_res != spec_res || h.mip_count < 1) return false;
+		
+		alloc_specular(h.mip_count);
+		
+		if (fread(specular.data.data, 1,specular.data.size, f) != specular.data.size) return false;
+		
+		for (u32 i=0; i<9; ++i) sh_irradiance[i] = h.sh[i];
+		return true;
+	}
+	void write_cache (u64 k) {
+		create_asset_cache_dir();
+		
+		auto filepath = ibl::get_cache_filepath(k);
+		
+		FILE* f = fopen(filepath.c_str(), "wb");
+		if (!f) {
+			con_logf_warning("could not write \"%s\", environment '%s' will be prefiltered again next launch.", filepath.c_str(), name.c_str());
+			return;
+		}
+		
+		defer { fclose(f); };
+		
+		ibl::Cache_Header h;
+		memcpy(h.magic, "IBL ", 4);
+		h.version =		ibl::CACHE_VERSION;
+		h.key =			k;
+		h.spec_res =	spec_res;
+		h.mip_count =	(u32)specular.mips.size();
+		for (u32 i=0; i<9; ++i) h.sh[i] = sh_irradiance[i];
+		
+		fwrite(&h, 1,sizeof(h), f);
+		fwrite(specular.data.data, 1,specular.data.size, f);
+	}
+};
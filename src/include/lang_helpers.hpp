@@ -110,6 +110,27 @@ static u32 round_up_to_pot (u32 i) {
 	return i;
 }
 
+// FNV-1a, for cache keys and the like (not cryptographic)
+static constexpr u64 FNV1A_OFFSET_BASIS =	0xcbf29ce484222325ull;
+static constexpr u64 FNV1A_PRIME =			0x100000001b3ull;
+
+static u64 hash_fnv1a (void const* data, u64 size, u64 h=FNV1A_OFFSET_BASIS) {
+	auto* cur = (u8 const*)data;
+	for (u64 i=0; i<size; ++i) {
+		h ^= cur[i];
+		h *= FNV1A_PRIME;
+	}
+	return h;
+}
+
+// 32 bit FNV-1a of a zero terminated string, constexpr so string literals can be hashed at compile time
+static constexpr u32 FNV1A32_OFFSET_BASIS =	0x811c9dc5u;
+static constexpr u32 FNV1A32_PRIME =		0x01000193u;
+
+static constexpr u32 hash_fnv1a_32 (char const* str, u32 h=FNV1A32_OFFSET_BASIS) {
+	return *str ? hash_fnv1a_32(str +1, (h ^ (u32)(u8)*str) * FNV1A32_PRIME) : h;
+}
+
 static u32 strlen (utf32 const* str) {
 	u32 ret = 0;
 	while (*str++) ++ret;
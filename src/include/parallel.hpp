@@ -0,0 +1,47 @@
+#include <thread>
+#include <atomic>
+
+static u32 get_worker_thread_count () {
+	u32 n = (u32)std::thread::hardware_concurrency();
+	return max(n, (u32)1); // hardware_concurrency is allowed to return 0 if unknown
+}
+
+// Calls func(i) for every i in [0, count) from all hardware threads (including the calling thread)
+//  work is handed out in chunks of chunk_size indices via an atomic counter, so uneven work per index balances itself
+//  returns once all indices are done
+template <typename FUNC>
+static void parallel_for (u32 count, FUNC func, u32 chunk_size=1) {
+	dbg_assert(chunk_size >= 1);
+	
+	u32 chunks = (count +chunk_size -1) / chunk_size;
+	u32 threads = min(get_worker_thread_count(), chunks);
+	
+	std::atomic<u32> next_chunk (0);
+	
+	auto worker = [&] () {
+		for (;;) {
+			u32 chunk = next_chunk++;
+			if (chunk >= chunks) break;
+			
+			u32 end = min((chunk +1) * chunk_size, count);
+			for (u32 i=chunk * chunk_size; i<end; ++i) {
+				func(i);
+			}
+		}
+	};
+	
+	if (threads <= 1) {
+		worker();
+		return;
+	}
+	
+	std::vector<std::thread> pool;
+	pool.reserve(threads -1);
+	
+	for (u32 i=0; i<threads -1; ++i) {
+		pool.emplace_back(worker);
+	}
+	worker();
+	
+	for (auto& t : pool) t.join();
+}
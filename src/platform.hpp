@@ -18,9 +18,11 @@ static void stop_mouse_look () {
 //
 
 int vsync_mode = 1;
+static u32 vsync_generation = 0; // bumped by every set_vsync
 static void set_vsync (int mode) {
 	vsync_mode = mode;
-	glfwSwapInterval(mode);
+	++vsync_generation;
+	if (glfwGetCurrentContext() == wnd) glfwSwapInterval(mode); // otherwise the render thread owns the context and applies it with the next frame
 }
 
 struct Rect {
@@ -0,0 +1,601 @@
+#include <emmintrin.h> // SSE2, always available on x64
+
+// PNG decoder for the common texture case (8 bit gray, gray alpha, rgb, rgba and palette images, not interlaced)
+//  -inflate with INFLATE_FAST_BITS lookup tables and a 64 bit bit buffer, into a buffer presized from IHDR (no reallocs)
+//  -SSE2 unfilter of 3 and 4 byte pixels (Sub/Avg/Paeth one pixel per register like libpng, Up 16 bytes at a time)
+//  -unfiltered rows go straight into the output, bottom-up like OpenGL wants it
+// same output as stbi_load(..., 0) with vertical flip on, anything else (16 bit, sub-byte, interlaced, tRNS on non palette images, corrupt files)
+// returns failure so the caller can fall back to stb_image
+// (jpeg stays with stb_image, it already does the IDCT and YCbCr conversion with SSE2 on x64)
+namespace png {
+	
+	//// inflate
+	static constexpr u32 INFLATE_FAST_BITS = 10;
+	
+	struct Huffman {
+		u16		fast[1 << INFLATE_FAST_BITS]; // (code length << 9) | symbol, 0 for codes longer than INFLATE_FAST_BITS
+		u16		first_code[16];
+		u16		first_symbol[16];
+		u32		max_code[17]; // max code +1 per length, left aligned to 16 bits
+		u8		size[288];
+		u16		value[288];
+	};
+	
+	static u32 bit_reverse (u32 v, u32 bits) {
+		u32 r = 0;
+		for (u32 i=0; i<bits; ++i) {
+			r = (r << 1) | (v & 1);
+			v >>= 1;
+		}
+		return r;
+	}
+	
+	static bool build_huffman (Huffman* h, u8 const* code_lengths, u32 count) {
+		u32 sizes[17] = {};
+		for (u32 i=0; i<count; ++i) sizes[code_lengths[i]]++;
+		sizes[0] = 0;
+		
+		for (u32 i=1; i<16; ++i) {
+			if (sizes[i] > (1u << i)) return false;
+		}
+		
+		memset(h->fast, 0, sizeof(h->fast));
+		
+		u32 next_code[16];
+		u32 code = 0;
+		u32 k = 0;
+		for (u32 i=1; i<16; ++i) {
+			next_code[i] = code;
+			h->first_code[i] = (u16)code;
+			h->first_symbol[i] = (u16)k;
+			code += sizes[i];
+			if (sizes[i] && code -1 >= (1u << i)) return false; // oversubscribed
+			h->max_code[i] = code << (16 -i);
+			code <<= 1;
+			k += sizes[i];
+		}
+		h->max_code[16] = 0x10000;
+		
+		for (u32 i=0; i<count; ++i) {
+			u32 s = code_lengths[i];
+			if (!s) continue;
+			
+			u32 c = next_code[s] -h->first_code[s] +h->first_symbol[s];
+			h->size[c] = (u8)s;
+			h->value[c] = (u16)i;
+			
+			if (s <= INFLATE_FAST_BITS) {
+				for (u32 j=bit_reverse(next_code[s], s); j<(1u << INFLATE_FAST_BITS); j += 1u << s) {
+					h->fast[j] = (u16)((s << 9) | i);
+				}
+			}
+			++next_code[s];
+		}
+		return true;
+	}
+	
+	struct Bit_Reader {
+		byte const*	cur;
+		byte const*	end;
+		u64			buf;
+		u32			cnt;
+		u32			overrun; // zero bytes fed past the end, a few are fine since we always refill to 56 bits
+		
+		void refill () {
+			while (cnt <= 56) {
+				u64 b = 0;
+				if (cur < end)	b = *cur++;
+				else			overrun++;
+				
+				buf |= b << cnt;
+				cnt += 8;
+			}
+		}
+		u32 bits (u32 n) {
+			if (cnt < n) refill();
+			u32 v = (u32)(buf & ((1ull << n) -1));
+			buf >>= n;
+			cnt -= n;
+			return v;
+		}
+		
+		s32 decode (Huffman const* h) { // returns -1 on error
+			if (cnt < 16) refill();
+			
+			u32 f = h->fast[buf & ((1u << INFLATE_FAST_BITS) -1)];
+			if (f) {
+				u32 s = f >> 9;
+				buf >>= s;
+				cnt -= s;
+				return f & 511;
+			}
+			
+			u32 k = bit_reverse((u32)(buf & 0xffff), 16);
+			u32 s;
+			for (s=INFLATE_FAST_BITS +1; k >= h->max_code[s]; ++s);
+			if (s >= 16) return -1;
+			
+			u32 c = (k >> (16 -s)) -h->first_code[s] +h->first_symbol[s];
+			if (c >= 288 || h->size[c] != s) return -1;
+			
+			buf >>= s;
+			cnt -= s;
+			return h->value[c];
+		}
+	};
+	
+	static Huffman const& get_fixed_litlen () {
+		static Huffman h = [] () {
+			Huffman h;
+			u8 lengths[288];
+			for (u32 i=0;   i<144; ++i) lengths[i] = 8;
+			for (u32 i=144; i<256; ++i) lengths[i] = 9;
+			for (u32 i=256; i<280; ++i) lengths[i] = 7;
+			for (u32 i=280; i<288; ++i) lengths[i] = 8;
+			build_huffman(&h, lengths, 288);
+			return h;
+		}();
+		return h;
+	}
+	static Huffman const& get_fixed_dist () {
+		static Huffman h = [] () {
+			Huffman h;
+			u8 lengths[30];
+			for (u32 i=0; i<30; ++i) lengths[i] = 5;
+			build_huffman(&h, lengths, 30);
+			return h;
+		}();
+		return h;
+	}
+	
+	static bool read_dynamic_tables (Bit_Reader* br, Huffman* litlen, Huffman* dist) {
+		static constexpr u8 ORDER[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+		
+		u32 hlit =	br->bits(5) +257;
+		u32 hdist =	br->bits(5) +1;
+		u32 hclen =	br->bits(4) +4;
+		
+		u8 codelength_lengths[19] = {};
+		for (u32 i=0; i<hclen; ++i) codelength_lengths[ORDER[i]] = (u8)br->bits(3);
+		
+		Huffman codelength;
+		if (!build_huffman(&codelength, codelength_lengths, 19)) return false;
+		
+		u8 lengths[286 +32];
+		u32 n = 0;
+		while (n < hlit +hdist) {
+			s32 sym = br->decode(&codelength);
+			if (sym < 0) return false;
+			
+			if (sym < 16) {
+				lengths[n++] = (u8)sym;
+				continue;
+			}
+			
+			u32 rep;
+			u8 val = 0;
+			if (sym == 16) {
+				if (n == 0) return false;
+				rep = br->bits(2) +3;
+				val = lengths[n -1];
+			} else if (sym == 17) {
+				rep = br->bits(3) +3;
+			} else {
+				rep = br->bits(7) +11;
+			}
+			if (n +rep > hlit +hdist) return false;
+			
+			memset(lengths +n, val, rep);
+			n += rep;
+		}
+		
+		return build_huffman(litlen, lengths, hlit) && build_huffman(dist, lengths +hlit, hdist);
+	}
+	
+	// inflates a zlib stream into out, which has to be exactly the size of the decompressed data plus 8 bytes of slack
+	static bool inflate (byte const* src, u64 src_size, byte* out, u64 out_size) {
+		static constexpr u16 LENGTH_BASE[29] =	{ 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+		static constexpr u8 LENGTH_EXTRA[29] =	{ 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+		static constexpr u16 DIST_BASE[30] =	{ 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+		static constexpr u8 DIST_EXTRA[30] =	{ 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+		
+		if (src_size < 2) return false;
+		if ((src[0] & 15) != 8 || (src[1] & 32) || ((u32)src[0] * 256 +src[1]) % 31 != 0) return false; // deflate, no preset dict, header check
+		
+		Bit_Reader br = { src +2, src +src_size, 0, 0, 0 };
+		
+		byte* out_cur = out;
+		byte* out_end = out +out_size;
+		
+		Huffman dyn_litlen, dyn_dist;
+		
+		for (;;) {
+			u32 final =	br.bits(1);
+			u32 type =	br.bits(2);
+			
+			if (type == 0) { // stored
+				br.bits(br.cnt % 8); // to byte boundary
+				
+				u32 len =	br.bits(16);
+				u32 nlen =	br.bits(16);
+				if ((len ^ 0xffff) != nlen) return false;
+				if (len > (u64)(out_end -out_cur)) return false;
+				
+				// bytes still in the bit buffer first
+				while (len && br.cnt >= 8) {
+					*out_cur++ = (byte)br.bits(8);
+					--len;
+				}
+				if (len > (u64)(br.end -br.cur)) return false;
+				memcpy(out_cur, br.cur, len);
+				out_cur += len;
+				br.cur += len;
+			} else {
+				Huffman const* litlen;
+				Huffman const* dist;
+				if (type == 1) {
+					litlen = &get_fixed_litlen();
+					dist = &get_fixed_dist();
+				} else if (type == 2) {
+					if (!read_dynamic_tables(&br, &dyn_litlen, &dyn_dist)) return false;
+					litlen = &dyn_litlen;
+					dist = &dyn_dist;
+				} else {
+					return false;
+				}
+				
+				for (;;) {
+					s32 sym = br.decode(litlen);
+					if (sym < 0) return false;
+					
+					if (sym < 256) {
+						if (out_cur == out_end) return false;
+						*out_cur++ = (byte)sym;
+						continue;
+					}
+					if (sym == 256) break;
+					
+					sym -= 257;
+					if (sym >= 29) return false;
+					u32 len = LENGTH_BASE[sym] +br.bits(LENGTH_EXTRA[sym]);
+					
+					s32 d = br.decode(dist);
+					if (d < 0 || d >= 30) return false;
+					u32 offs = DIST_BASE[d] +br.bits(DIST_EXTRA[d]);
+					
+					if (offs > (u64)(out_cur -out) || len > (u64)(out_end -out_cur)) return false;
+					
+					byte const* from = out_cur -offs;
+					if (offs >= 8) { // 8 bytes at a time, can write up to 7 bytes past len into the slack
+						for (u32 i=0; i<len; i += 8) memcpy(out_cur +i, from +i, 8);
+					} else if (offs == 1) {
+						memset(out_cur, *from, len);
+					} else {
+						for (u32 i=0; i<len; ++i) out_cur[i] = from[i];
+					}
+					out_cur += len;
+				}
+			}
+			
+			if (br.overrun > 8) return false; // ran past the end of the data
+			if (final) break;
+		}
+		
+		return out_cur == out_end;
+	}
+	
+	//// unfilter
+	enum filter_e : u8 {
+		F_NONE		=0,
+		F_SUB		,
+		F_UP		,
+		F_AVG		,
+		F_PAETH		,
+	};
+	
+	static byte paeth (s32 a, s32 b, s32 c) {
+		s32 p = a +b -c;
+		s32 pa = abs(p -a);
+		s32 pb = abs(p -b);
+		s32 pc = abs(p -c);
+		if (pa <= pb && pa <= pc) return (byte)a;
+		if (pb <= pc) return (byte)b;
+		return (byte)c;
+	}
+	
+	static void unfilter_row_scalar (u32 filter, byte const* src, byte const* prior, byte* dst, u32 row_bytes, u32 bpp) {
+		for (u32 i=0; i<row_bytes; ++i) {
+			s32 a = i >= bpp ? dst[i -bpp] : 0;
+			s32 b = prior[i];
+			s32 c = i >= bpp ? prior[i -bpp] : 0;
+			
+			switch (filter) {
+				case F_NONE:	dst[i] = src[i];									break;
+				case F_SUB:		dst[i] = (byte)(src[i] +a);							break;
+				case F_UP:		dst[i] = (byte)(src[i] +b);							break;
+				case F_AVG:		dst[i] = (byte)(src[i] +((a +b) >> 1));				break;
+				case F_PAETH:	dst[i] = (byte)(src[i] +paeth(a, b, c));			break;
+			}
+		}
+	}
+	
+	// 3 byte pixels are moved as 4 bytes (the extra byte belongs to the next pixel and is ignored or overwritten later)
+	// except for the last pixel of a row, going through a 3 byte memcpy for every pixel would stall on store forwarding
+	template <u32 BPP> static __m128i load_px (byte const* p, bool last) {
+		u32 v;
+		if (BPP == 4 || !last)	memcpy(&v, p, 4);
+		else					v = (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16);
+		return _mm_cvtsi32_si128((int)v);
+	}
+	template <u32 BPP> static void store_px (byte* p, __m128i x, bool last) {
+		u32 v = (u32)_mm_cvtsi128_si32(x);
+		if (BPP == 4 || !last) {
+			memcpy(p, &v, 4);
+		} else {
+			p[0] = (byte)v;
+			p[1] = (byte)(v >> 8);
+			p[2] = (byte)(v >> 16);
+		}
+	}
+	
+	static __m128i abs_epi16 (__m128i x) {
+		return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+	}
+	static __m128i select (__m128i mask, __m128i a, __m128i b) { // mask ? a : b
+		return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+	}
+	
+	// Sub, Avg and Paeth depend on the previous pixel, so only the channels of one pixel are done in parallel
+	template <u32 BPP> static void unfilter_row_sse2 (u32 filter, byte const* src, byte const* prior, byte* dst, u32 row_bytes) {
+		__m128i zero = _mm_setzero_si128();
+		
+		switch (filter) {
+			case F_NONE: {
+				memcpy(dst, src, row_bytes);
+			} break;
+			
+			case F_SUB: {
+				__m128i a = zero;
+				for (u32 i=0; i<row_bytes; i += BPP) {
+					bool last = i +BPP == row_bytes;
+					a = _mm_add_epi8(a, load_px<BPP>(src +i, last));
+					store_px<BPP>(dst +i, a, last);
+				}
+			} break;
+			
+			case F_UP: {
+				u32 i = 0;
+				for (; i +16 <= row_bytes; i += 16) {
+					__m128i x = _mm_add_epi8(_mm_loadu_si128((__m128i const*)(src +i)), _mm_loadu_si128((__m128i const*)(prior +i)));
+					_mm_storeu_si128((__m128i*)(dst +i), x);
+				}
+				for (; i<row_bytes; ++i) dst[i] = (byte)(src[i] +prior[i]);
+			} break;
+			
+			case F_AVG: {
+				__m128i ones = _mm_set1_epi8(1);
+				__m128i a = zero;
+				for (u32 i=0; i<row_bytes; i += BPP) {
+					bool last = i +BPP == row_bytes;
+					__m128i b = load_px<BPP>(prior +i, last);
+					
+					// avg_epu8 rounds up, the filter rounds down
+					__m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), ones));
+					
+					a = _mm_add_epi8(avg, load_px<BPP>(src +i, last));
+					store_px<BPP>(dst +i, a, last);
+				}
+			} break;
+			
+			case F_PAETH: {
+				// in 16 bit lanes, so a +b -2c can not overflow
+				__m128i a = zero;
+				__m128i c = zero;
+				for (u32 i=0; i<row_bytes; i += BPP) {
+					bool last = i +BPP == row_bytes;
+					__m128i b = _mm_unpacklo_epi8(load_px<BPP>(prior +i, last), zero);
+					
+					__m128i pa = _mm_sub_epi16(b, c); // p -a
+					__m128i pb = _mm_sub_epi16(a, c); // p -b
+					__m128i pc = _mm_add_epi16(pa, pb); // p -c
+					
+					pa = abs_epi16(pa);
+					pb = abs_epi16(pb);
+					pc = abs_epi16(pc);
+					
+					__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+					
+					// ties favor a over b over c
+					__m128i nearest = select(_mm_cmpeq_epi16(smallest, pc), c, b);
+					nearest = select(_mm_cmpeq_epi16(smallest, pb), b, nearest);
+					nearest = select(_mm_cmpeq_epi16(smallest, pa), a, nearest);
+					
+					__m128i x = _mm_add_epi8(_mm_packus_epi16(nearest, nearest), load_px<BPP>(src +i, last));
+					store_px<BPP>(dst +i, x, last);
+					
+					a = _mm_unpacklo_epi8(x, zero);
+					c = b;
+				}
+			} break;
+		}
+	}
+	
+	static void unfilter_row (u32 filter, byte const* src, byte const* prior, byte* dst, u32 row_bytes, u32 bpp) {
+		switch (bpp) {
+			case 3:		unfilter_row_sse2<3>(filter, src, prior, dst, row_bytes);			break;
+			case 4:		unfilter_row_sse2<4>(filter, src, prior, dst, row_bytes);			break;
+			default:	unfilter_row_scalar(filter, src, prior, dst, row_bytes, bpp);		break;
+		}
+	}
+	
+	//// file
+	struct Image {
+		iv2					dim;
+		u32					color_type;
+		u32					channels; // in the file, 1 for palette images
+		u32					out_channels; // what we output, like stb_image
+		
+		std::vector<byte>	idat;
+		
+		byte				palette[256 * 4];
+		bool				has_trns;
+	};
+	
+	static u32 read_be32 (byte const* p) {
+		return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+	}
+	
+	static bool parse (byte const* file, u64 size, Image* img) { // false if not a png or not supported
+		static constexpr byte SIGNATURE[8] = { 137,80,78,71,13,10,26,10 };
+		if (size < 8 || memcmp(file, SIGNATURE, 8) != 0) return false;
+		
+		byte const* cur = file +8;
+		byte const* end = file +size;
+		
+		bool got_header = false;
+		u32 palette_size = 0;
+		img->has_trns = false;
+		
+		for (;;) {
+			if (end -cur < 12) return false;
+			
+			u32 len = read_be32(cur);
+			byte const* type = cur +4;
+			byte const* data = cur +8;
+			if (len > (u64)(end -data) -4) return false;
+			
+			cur = data +len +4; // skip crc, not checked (like stb_image)
+			
+			if (memcmp(type, "IHDR", 4) == 0) {
+				if (len != 13) return false;
+				
+				img->dim = iv2((s32)read_be32(data), (s32)read_be32(data +4));
+				u32 bit_depth =		data[8];
+				img->color_type =	data[9];
+				u32 interlace =		data[12];
+				
+				if (img->dim.x <= 0 || img->dim.y <= 0 || (u64)img->dim.x * img->dim.y > (1u << 28)) return false;
+				if (bit_depth != 8 || interlace != 0 || data[10] != 0 || data[11] != 0) return false; // only the fast path
+				
+				switch (img->color_type) {
+					case 0:	img->channels = 1;	break;
+					case 2:	img->channels = 3;	break;
+					case 3:	img->channels = 1;	break;
+					case 4:	img->channels = 2;	break;
+					case 6:	img->channels = 4;	break;
+					default: return false;
+				}
+				got_header = true;
+			
+			} else if (memcmp(type, "PLTE", 4) == 0) {
+				palette_size = len / 3;
+				if (palette_size > 256 || palette_size * 3 != len) return false;
+				
+				for (u32 i=0; i<palette_size; ++i) {
+					img->palette[i*4 +0] = data[i*3 +0];
+					img->palette[i*4 +1] = data[i*3 +1];
+					img->palette[i*4 +2] = data[i*3 +2];
+					img->palette[i*4 +3] = 255;
+				}
+			} else if (memcmp(type, "tRNS", 4) == 0) {
+				if (!got_header || img->color_type != 3 || len > palette_size) return false; // stb adds an alpha channel for the other types, not supported here
+				
+				for (u32 i=0; i<len; ++i) img->palette[i*4 +3] = data[i];
+				img->has_trns = true;
+			
+			} else if (memcmp(type, "IDAT", 4) == 0) {
+				img->idat.insert(img->idat.end(), data, data +len);
+			
+			} else if (memcmp(type, "IEND", 4) == 0) {
+				break;
+			
+			} else if (!(type[0] & 32)) {
+				return false; // unknown critical chunk
+			}
+		}
+		
+		if (!got_header || img->idat.size() == 0) return false;
+		if (img->color_type == 3 && palette_size == 0) return false;
+		
+		img->out_channels = img->color_type == 3 ? (img->has_trns ? 4 : 3) : img->channels;
+		return true;
+	}
+	
+	// out has to be dim.x * dim.y * out_channels bytes, rows get written bottom-up
+	static bool decode (Image const& img, byte* out) {
+		u32 w = (u32)img.dim.x;
+		u32 h = (u32)img.dim.y;
+		
+		u32 row_bytes = w * img.channels;
+		u64 raw_size = (u64)h * (1 +row_bytes);
+		
+		std::vector<byte> raw (raw_size +8); // +8 slack for inflate
+		if (!inflate(img.idat.data(), img.idat.size(), raw.data(), raw_size)) return false;
+		
+		std::vector<byte> zero_row (row_bytes, 0);
+		
+		u64 out_stride = (u64)w * img.out_channels;
+		
+		if (img.color_type != 3) {
+			byte const* prior = zero_row.data();
+			for (u32 y=0; y<h; ++y) {
+				byte const* src = &raw[y * (1 +(u64)row_bytes)];
+				if (src[0] > F_PAETH) return false;
+				
+				byte* dst = out +(h -1 -y) * out_stride;
+				unfilter_row(src[0], src +1, prior, dst, row_bytes, img.channels);
+				prior = dst;
+			}
+		} else {
+			// unfilter the palette indices in place, then expand
+			byte const* prior = zero_row.data();
+			for (u32 y=0; y<h; ++y) {
+				byte* src = &raw[y * (1 +(u64)row_bytes)];
+				if (src[0] > F_PAETH) return false;
+				
+				unfilter_row_scalar(src[0], src +1, prior, src +1, row_bytes, 1);
+				prior = src +1;
+				
+				byte* dst = out +(h -1 -y) * out_stride;
+				for (u32 x=0; x<w; ++x) {
+					memcpy(dst +x * img.out_channels, &img.palette[src[1 +x] * 4], img.out_channels);
+				}
+			}
+		}
+		return true;
+	}
+	
+	// like stbi_load(filepath, w, h, n, 0) with vertical flip on (result is malloc'ed), nullptr if the file is not a png we support
+	static byte* load (cstr filepath, int* w, int* h, int* n) {
+		Data_Block file;
+		if (!read_entire_file(filepath, &file)) return nullptr;
+		defer { file.free(); };
+		
+		Image img;
+		if (!parse(file.data, file.size, &img)) return nullptr;
+		
+		byte* out = (byte*)malloc((u64)img.dim.x * img.dim.y * img.out_channels);
+		if (!decode(img, out)) {
+			free(out);
+			return nullptr;
+		}
+		
+		*w = img.dim.x;
+		*h = img.dim.y;
+		*n = (int)img.out_channels;
+		return out;
+	}
+	
+	// decode directly into buf if the png has exactly expected_dim and req_comp channels
+	static bool load_into (cstr filepath, iv2 expected_dim, int req_comp, byte* buf) {
+		Data_Block file;
+		if (!read_entire_file(filepath, &file)) return false;
+		defer { file.free(); };
+		
+		Image img;
+		if (!parse(file.data, file.size, &img)) return false;
+		if (any(img.dim != expected_dim) || (int)img.out_channels != req_comp) return false;
+		
+		return decode(img, buf);
+	}
+}
@@ -0,0 +1,277 @@
+
+// Sorted draw submission
+//  draws are recorded as commands with a 64 bit sort key, radix sorted and then executed in key order
+//  the executor only rebinds what differs from the previous command (and gl_state drops whatever is still redundant)
+//  depth keys:			pass | shader | texture set (alpha tested only) | geometry | depth front-to-back
+//  opaque keys:		pass | shader | texture set | geometry | depth front-to-back (early-z)
+//  translucent keys:	pass | depth back-to-front | subpass | shader | texture set
+//   each translucent mesh draws its pass 1 right before its pass 2, like it did before the queue
+//  ids that do not fit their bits get masked, that only costs state changes, the executor compares the real objects
+//  runs of opaque commands with the same shader, textures and arena geometry become one instanced draw (see instancing in gl.hpp)
+//  the optional depth prepass draws the opaque meshes with their position only depth_vbo first, so the opaque pass only shades visible pixels
+namespace render_queue {
+	static bool		depth_prepass =		false; // only pays off with expensive fragment shaders, the opaque draws are sorted front to back anyway
+	static Shader*	shad_depth =		nullptr; // depth.vert/depth.frag, variants with the ALPHA_TEST and TEX_ARRAYS of the mesh shader
+	
+	enum pass_e {
+		PASS_DEPTH=0,
+		PASS_OPAQUE,
+		PASS_TRANSLUCENT,
+	};
+	
+	static cstr				PASS_NAMES[] = { "depth prepass", "opaque", "translucent" }; // gpu_profiler scopes
+	
+	static constexpr u32	NO_TEXTURES =	(u32)-2; // texture_set of commands that do not sample textures
+	
+	struct Command {
+		Base_Mesh*						mesh;
+		Vbo*							vbo;
+		Shader*							shad; // the variant to draw with
+		gl_state::Render_State const*	rs;
+		u32								texture_set;
+	};
+	struct Sort_Item {
+		u64		key;
+		u32		cmd; // index into commands
+	};
+	
+	// items [first_item, first_item +count) drawn either one by one or instanced with inst_shad
+	struct Batch {
+		u32		first_item;
+		u32		count;
+		Shader*	inst_shad;
+		u32		first_instance;
+	};
+	
+	static std::vector<Command>			commands;
+	static std::vector<Sort_Item>		items;
+	static std::vector<Sort_Item>		items_tmp;
+	static std::vector<Batch>			batches;
+	
+	// texture sets are interned so meshes with the same textures on the same units share an id
+	static std::vector< std::vector<Allotted_Texture> >	texture_sets;
+	
+	static u32 get_texture_set (std::vector<Allotted_Texture> const& t) {
+		auto same = [] (std::vector<Allotted_Texture> const& l, std::vector<Allotted_Texture> const& r) {
+			if (l.size() != r.size()) return false;
+			for (u64 i=0; i<l.size(); ++i) {
+				if (l[i].tex_unit != r[i].tex_unit || l[i].tex != r[i].tex) return false;
+			}
+			return true;
+		};
+		for (u32 i=0; i<(u32)texture_sets.size(); ++i) {
+			if (same(texture_sets[i], t)) return i;
+		}
+		texture_sets.push_back(t);
+		return (u32)texture_sets.size() -1;
+	}
+	
+	static u64 bits (u64 val, u32 count, u32 shift) {
+		return (val & ((1ull << count) -1)) << shift;
+	}
+	// positive floats sort like their bit patterns, the top 24 of the 31 non-sign bits are plenty for sorting
+	static u64 depth_bits (f32 dist) {
+		dist = max(dist, 0.0f);
+		u32 u;
+		memcpy(&u, &dist, sizeof(u));
+		return u >> 7;
+	}
+	
+	static u64 opaque_key (pass_e pass, u32 shader, u32 texture_set, u32 geometry, f32 dist) {
+		return	bits(pass,			2, 62) |
+				bits(shader,		12, 50) |
+				bits(texture_set,	14, 36) |
+				bits(geometry,		12, 24) |
+				bits(depth_bits(dist), 24, 0);
+	}
+	// arena meshes share the vao, so sort by their allocation, which also puts the instanceable ones next to each other
+	static u32 get_geometry_id (Vbo& vbo) {
+		if (vbo.storage == VBO_ARENA) return vbo.arena_alloc ? vbo.arena_alloc->id : 0;
+		return vbo.get_vao();
+	}
+	static u64 translucent_key (f32 dist, u32 subpass, u32 shader, u32 texture_set) {
+		return	bits(PASS_TRANSLUCENT,				2, 62) |
+				bits(0xffffff -depth_bits(dist),	24, 38) |
+				bits(subpass,						1, 37) |
+				bits(shader,						12, 25) |
+				bits(texture_set,					14, 11);
+	}
+	
+	// LSD radix sort by 8 bit digits, digits that are the same for every item are skipped (most of them usually are)
+	//  stable, so equal keys keep their recording order
+	static void radix_sort (std::vector<Sort_Item>* items, std::vector<Sort_Item>* tmp) {
+		u64 count = items->size();
+		tmp->resize(count);
+		
+		for (u32 digit=0; digit<8; ++digit) {
+			u32 shift = digit * 8;
+			
+			u64 offsets[256] = {};
+			for (auto& it : *items) ++offsets[(it.key >> shift) & 0xff];
+			
+			if (count == 0 || offsets[((*items)[0].key >> shift) & 0xff] == count) continue; // all in one bucket
+			
+			u64 sum = 0;
+			for (auto& o : offsets) {
+				u64 c = o;
+				o = sum;
+				sum += c;
+			}
+			for (auto& it : *items) (*tmp)[ offsets[(it.key >> shift) & 0xff]++ ] = it;
+			
+			std::swap(*items, *tmp);
+		}
+	}
+	
+	static void begin () {
+		commands.clear();
+		items.clear();
+	}
+	
+	static void push (u64 key, Command const& c) {
+		items.push_back({ key, (u32)commands.size() });
+		commands.push_back(c);
+	}
+	
+	// the depth.vert variant for a mesh, alpha tested meshes need their albedo (texture unit 0) and uvs
+	static Shader* get_depth_shader (Base_Mesh* m) {
+		if (!m->shad_depth) {
+			std::vector<str> d;
+			if (m->shad->has_define("ALPHA_TEST"))	d.push_back("ALPHA_TEST");
+			if (m->shad->has_define("TEX_ARRAYS"))	d.push_back("TEX_ARRAYS");
+			m->shad_depth = shad_depth->get_variant(d); // compiles in the background, the mesh skips the prepass until then
+		}
+		return m->shad_depth;
+	}
+	
+	static void record_depth (Base_Mesh* m, f32 dist) {
+		if (!shad_depth) return;
+		
+		auto* s = get_depth_shader(m);
+		if (!s->valid()) return;
+		
+		u32 texture_set = m->shad->has_define("ALPHA_TEST") ? m->texture_set : NO_TEXTURES;
+		
+		// the full vbo works too (same attribute locations), if the depth stream was not generated
+		Vbo* vbo = m->depth_vbo.arena_alloc ? &m->depth_vbo : &m->vbo;
+		
+		push(opaque_key(PASS_DEPTH, s->sort_id, texture_set, get_geometry_id(*vbo), dist), { m, vbo, s, &gl_state::RS_DEPTH_ONLY, texture_set });
+	}
+	
+	// dist is the distance of the mesh from the camera, the ubo::Object slot of the mesh has to be pushed already
+	static void record_mesh (Base_Mesh* m, pass_e pass, f32 dist) {
+		if (m->texture_set == (u32)-1) m->texture_set = get_texture_set(m->textures);
+		
+		if (pass == PASS_OPAQUE) {
+			if (!m->shad->valid()) return;
+			
+			if (depth_prepass) record_depth(m, dist);
+			
+			auto* s = m->shad->get_draw_variant();
+			push(opaque_key(PASS_OPAQUE, s->sort_id, m->texture_set, get_geometry_id(m->vbo), dist), { m, &m->vbo, s, &gl_state::RS_OPAQUE, m->texture_set });
+		} else {
+			if (m->shad->valid()) {
+				auto* s = m->shad->get_draw_variant();
+				push(translucent_key(dist, 0, s->sort_id, m->texture_set), { m, &m->vbo, s, &gl_state::RS_OPAQUE, m->texture_set });
+			}
+			if (m->shad_transp_pass2->valid()) {
+				auto* s = m->shad_transp_pass2->get_draw_variant();
+				push(translucent_key(dist, 1, s->sort_id, m->texture_set), { m, &m->vbo, s, &gl_state::RS_TRANSPARENT, m->texture_set });
+			}
+		}
+	}
+	
+	static void sort () {
+		radix_sort(&items, &items_tmp);
+	}
+	
+	static bool can_instance (Command const& l, Command const& r) {
+		return	l.rs == &gl_state::RS_OPAQUE && r.rs == l.rs && l.shad == r.shad && l.texture_set == r.texture_set &&
+				l.vbo->storage == VBO_ARENA && l.vbo->arena_alloc &&
+				l.vbo->arena_alloc == r.vbo->arena_alloc;
+	}
+	
+	// splits the sorted items into batches and writes the instances of the instanced ones
+	//  objects are this frames ubo::Object data indexed by ubo_slot (the frame packet), not the live mesh state
+	static void build_batches (std::vector<ubo::Object> const& objects) {
+		batches.clear();
+		instancing::begin();
+		
+		for (u32 i=0; i<(u32)items.size();) {
+			auto& first = commands[items[i].cmd];
+			bool opaque = (items[i].key >> 62) == PASS_OPAQUE;
+			
+			u32 count = 1;
+			if (instancing::enable && opaque) {
+				while (i +count < (u32)items.size() && can_instance(first, commands[items[i +count].cmd])) ++count;
+			}
+			
+			Shader* inst_shad = nullptr;
+			if (count >= max(instancing::min_instances, (u32)2)) {
+				inst_shad = first.shad->get_variant({ "INSTANCED" }); // compiles in the background, until then we draw one by one
+				if (!inst_shad->valid() || !inst_shad->instanced) inst_shad = nullptr;
+			}
+			
+			if (inst_shad) {
+				u32 first_instance = (u32)instancing::instances.size();
+				for (u32 j=i; j<i +count; ++j) {
+					auto& o = objects[commands[items[j].cmd].mesh->ubo_slot];
+					instancing::push({ o.model_to_world, o.model_col });
+				}
+				batches.push_back({ i, count, inst_shad, first_instance });
+			} else {
+				for (u32 j=i; j<i +count; ++j) batches.push_back({ j, 1, nullptr, 0 });
+			}
+			
+			i += count;
+		}
+		
+		instancing::upload();
+	}
+	
+	static void execute (std::vector<ubo::Object> const& objects) {
+		build_batches(objects);
+		
+		gl_state::Render_State const*	cur_rs = nullptr;
+		Shader*							cur_shad = nullptr;
+		u32								cur_texture_set = (u32)-1;
+		Base_Mesh*						cur_mesh = nullptr;
+		u32								cur_pass = (u32)-1;
+		
+		for (auto& b : batches) {
+			auto& c = commands[items[b.first_item].cmd];
+			auto* shad = b.inst_shad ? b.inst_shad : c.shad;
+			
+			u32 pass = (u32)(items[b.first_item].key >> 62);
+			if (pass != cur_pass) {
+				if (cur_pass != (u32)-1) gpu_profiler::end_scope();
+				gpu_profiler::begin_scope(PASS_NAMES[pass]);
+				cur_pass = pass;
+			}
+			
+			if (c.rs != cur_rs) {
+				gl_state::set_render_state(*c.rs);
+				cur_rs = c.rs;
+			}
+			if (shad != cur_shad) {
+				shad->bind();
+				cur_shad = shad;
+				cur_mesh = nullptr; // tex_layers is per program
+			}
+			if (c.texture_set != NO_TEXTURES && c.texture_set != cur_texture_set) {
+				c.mesh->bind_textures();
+				cur_texture_set = c.texture_set;
+			}
+			if (c.mesh != cur_mesh) {
+				ubo::bind_object(c.mesh->ubo_slot); // unused by instanced draws, but cheap
+				c.mesh->set_tex_layers(shad);
+				cur_mesh = c.mesh;
+			}
+			
+			if (b.inst_shad)	c.vbo->draw_instanced(b.first_instance, b.count);
+			else				c.vbo->draw_entire();
+		}
+		
+		if (cur_pass != (u32)-1) gpu_profiler::end_scope();
+	}
+}
@@ -0,0 +1,191 @@
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Render thread that owns the gl context after startup
+//  the main thread polls events, updates the camera and fills a Frame_Packet with everything the frame needs (view, per mesh transforms, settings)
+//  the render thread consumes the packets in order and does all gl work (hot reloads, texture streaming, submission, swap)
+//  there are PACKETS packets, so the main thread prepares frame N+1 while frame N is submitted, and waits if it gets further ahead
+//  a packet is only touched by the render thread between being submitted and consumed, so it needs no locking itself
+//  the meshes lists are fixed after startup, packets refer to them by index (opaque meshes, then translucent ones)
+namespace render_thread {
+	static bool				enable =		true; // off submits on the main thread, the same way (--no_render_thread)
+	
+	static constexpr u32	PACKETS =		2;
+	
+	// renderer settings the key bindings change, applied by the render thread when they differ from the last packet
+	struct Settings {
+		bool	shader_debug;
+		bool	depth_prepass;
+		bool	gpu_profiler_overlay;
+		bool	gpu_profiler_csv;
+		bool	render_stats_overlay;
+		
+		bool	low_latency;
+		u32		max_frames_in_flight;
+		
+		int		vsync_mode;
+		u32		vsync_generation; // toggle_fullscreen reapplies the same mode
+	};
+	
+	struct Frame_Packet {
+		u32							frame_i;
+		iv2							wnd_dim;
+		f64							input_t; // when input was sampled, for frame_pacing
+		
+		ubo::View					view;
+		hm							world_to_cam;
+		f32							vfov;
+		
+		std::vector<ubo::Object>	objects; // per mesh, meshes_opaque then meshes_translucent
+		
+		Settings					settings;
+	};
+	
+	// written by the render thread after each frame, for the window title
+	struct Frame_Stats {
+		u64		gl_calls;
+		u64		gl_calls_skipped;
+		
+		frame_pacing::Timing_Window::Summary	latency;
+	};
+	
+	static Settings					settings; // main thread only, the next packet takes a copy
+	
+	static Frame_Packet				packets[PACKETS];
+	static u64						submitted =		0;
+	static u64						consumed =		0;
+	static bool						quit =			false;
+	static Frame_Stats				stats =			{};
+	static std::mutex				mutex; // protects the above counters, quit and stats
+	static std::condition_variable	cv;
+	
+	static std::thread				thread;
+	static bool						running =		false;
+	
+	static std::function<void (Frame_Packet const&)>	render_func;
+	static Settings					applied;
+	static bool						applied_valid =	false;
+	
+	static void apply_settings (Settings const& s) {
+		shader_debug =					s.shader_debug;
+		render_queue::depth_prepass =	s.depth_prepass;
+		gpu_profiler::show_overlay =	s.gpu_profiler_overlay;
+		render_stats::show_overlay =	s.render_stats_overlay;
+		
+		frame_pacing::low_latency =				s.low_latency;
+		frame_pacing::max_frames_in_flight =	s.max_frames_in_flight;
+		
+		if (!applied_valid || s.gpu_profiler_csv != applied.gpu_profiler_csv) // gpu_profiler turns it off if the file can not be opened, until toggled again
+			gpu_profiler::write_csv = s.gpu_profiler_csv;
+		
+		if (!applied_valid || s.vsync_generation != applied.vsync_generation)
+			glfwSwapInterval(s.vsync_mode);
+		
+		applied = s;
+		applied_valid = true;
+	}
+	
+	static void render_packet (Frame_Packet const& p) {
+		apply_settings(p.settings);
+		
+		render_func(p);
+		frame_pacing::end_frame(p.input_t);
+		
+		std::lock_guard<std::mutex> lock (mutex);
+		stats.gl_calls = gl_state::last_issued;
+		stats.gl_calls_skipped = gl_state::last_skipped;
+		stats.latency = frame_pacing::latencies.summarize();
+	}
+	
+	static void run () {
+		glfwMakeContextCurrent(wnd);
+		
+		for (;;) {
+			Frame_Packet* p;
+			{
+				std::unique_lock<std::mutex> lock (mutex);
+				cv.wait(lock, [] () { return quit || consumed < submitted; });
+				if (consumed == submitted) break; // quit, everything submitted was rendered
+				
+				p = &packets[consumed % PACKETS];
+			}
+			
+			render_packet(*p);
+			
+			{
+				std::lock_guard<std::mutex> lock (mutex);
+				++consumed;
+			}
+			cv.notify_all();
+		}
+		
+		glfwMakeContextCurrent(NULL);
+	}
+	
+	// call with the context current on the main thread, after loading, it moves to the render thread
+	static void start (std::function<void (Frame_Packet const&)> render) {
+		render_func = render;
+		
+		settings.shader_debug =			shader_debug;
+		settings.depth_prepass =		render_queue::depth_prepass;
+		settings.gpu_profiler_overlay =	gpu_profiler::show_overlay;
+		settings.gpu_profiler_csv =		gpu_profiler::write_csv;
+		settings.render_stats_overlay =	render_stats::show_overlay;
+		settings.low_latency =			frame_pacing::low_latency;
+		settings.max_frames_in_flight =	frame_pacing::max_frames_in_flight;
+		
+		if (!enable) return;
+		
+		glfwMakeContextCurrent(NULL);
+		thread = std::thread(run);
+		running = true;
+	}
+	// renders the packets still queued, the context is current on the main thread again afterwards
+	static void stop () {
+		if (!running) return;
+		
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			quit = true;
+		}
+		cv.notify_all();
+		thread.join();
+		running = false;
+		
+		glfwMakeContextCurrent(wnd);
+	}
+	
+	// the packet to fill for the next frame, waits while the render thread is PACKETS frames behind
+	//  in low_latency mode until it is idle, so the packet gets input sampled right before it is rendered
+	static Frame_Packet* begin_packet () {
+		if (!running) return &packets[0];
+		
+		u64 max_ahead = settings.low_latency ? 0 : PACKETS -1;
+		
+		std::unique_lock<std::mutex> lock (mutex);
+		cv.wait(lock, [&] () { return submitted -consumed <= max_ahead; });
+		return &packets[submitted % PACKETS];
+	}
+	static void submit_packet (Frame_Packet* p) {
+		p->settings = settings;
+		p->settings.vsync_mode = vsync_mode;
+		p->settings.vsync_generation = vsync_generation;
+		
+		if (!running) {
+			render_packet(*p);
+			return;
+		}
+		
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			++submitted;
+		}
+		cv.notify_all();
+	}
+	
+	static Frame_Stats get_stats () {
+		std::lock_guard<std::mutex> lock (mutex);
+		return stats;
+	}
+}
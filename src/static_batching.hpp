@@ -0,0 +1,142 @@
+
+// Static batching, merges opaque meshes flagged is_static that draw with the same shader and textures into one pre-transformed mesh
+//  (like the nier models, which are split into many parts at the same position)
+//  the sources stay in meshes so they still load and hot reload, but are not drawn themselves and never upload their vbo
+//  a batch remembers the vertex and index range and bounds of each source, for debugging and culling
+namespace static_batching {
+	static bool		enable =		true;
+	
+	struct Static_Batch : public Base_Mesh {
+		struct Source {
+			Base_Mesh*	mesh;
+			u32			vert_begin;
+			u32			vert_count;
+			u32			indx_begin;
+			u32			indx_count;
+			
+			v3			bounds_center; // world space
+			f32			bounds_radius;
+		};
+		std::vector<Source>		sources;
+		
+		bool					dirty =		false; // a source was hot reloaded
+		
+		Static_Batch (strcr n, Base_Mesh* first):
+				Base_Mesh{n, first->shad, first->shad_transp_pass2, 0, m3::ident()} {
+			textures = first->textures;
+		}
+		
+		// the normal matrix (inverse transpose) of the upper 3x3, up to a scale factor, via the cofactors
+		static m3 get_normal_matrix (m3 m, f32* det) {
+			*det = dot(m.arr[0], cross(m.arr[1], m.arr[2]));
+			m3 n = m3::column(cross(m.arr[1], m.arr[2]), cross(m.arr[2], m.arr[0]), cross(m.arr[0], m.arr[1]));
+			return *det < 0 ? m3::column(-n.arr[0], -n.arr[1], -n.arr[2]) : n;
+		}
+		
+		void append (Source* s) {
+			auto* src = s->mesh;
+			hm transform = src->get_transform();
+			
+			f32 det;
+			m3 norm_transform = get_normal_matrix(transform.m3(), &det);
+			
+			auto* verts = (Mesh_Vertex const*)src->vbo.vertecies.data();
+			u32 vert_count = (u32)(src->vbo.vertecies.size() / sizeof(Mesh_Vertex));
+			
+			s->vert_begin = (u32)(vbo.vertecies.size() / sizeof(Mesh_Vertex));
+			s->vert_count = vert_count;
+			
+			auto* out = (Mesh_Vertex*)&*vector_append(&vbo.vertecies, vert_count * sizeof(Mesh_Vertex));
+			for (u32 i=0; i<vert_count; ++i) {
+				auto v = verts[i];
+				v.pos_model =	transform * v.pos_model;
+				v.norm_model =	normalize(norm_transform * v.norm_model);
+				v.tang_model =	v4(normalize(transform.m3() * v.tang_model.xyz()), det < 0 ? -v.tang_model.w : v.tang_model.w);
+				v.col =			v.col * src->col; // baked, the batch draws with col 1
+				out[i] = v;
+			}
+			
+			// everything is indexed in the batch, non-indexed sources get their trivial indices
+			s->indx_begin = (u32)vbo.indices.size();
+			if (src->vbo.format_is_indexed()) {
+				for (auto i : src->vbo.indices) vbo.indices.push_back(s->vert_begin +i);
+			} else {
+				for (u32 i=0; i<vert_count; ++i) vbo.indices.push_back(s->vert_begin +i);
+			}
+			s->indx_count = (u32)vbo.indices.size() -s->indx_begin;
+			
+			s->bounds_center = transform * src->bounds_center;
+			s->bounds_radius = src->bounds_radius * max(src->scale.x, max(src->scale.y, src->scale.z));
+		}
+		
+		virtual void load () {
+			vbo.clear();
+			for (auto& s : sources) append(&s);
+			dirty = false;
+		}
+		virtual bool reload_if_needed () {
+			if (!dirty) return false;
+			
+			con_logf("rebuilding static batch \"%s\".", name.c_str());
+			load();
+			calc_texel_density_info();
+			upload();
+			return true;
+		}
+		virtual void source_changed () {
+			dirty = true;
+		}
+	};
+	
+	static std::vector<Static_Batch*>	batches;
+	
+	static bool can_batch (Base_Mesh* m) {
+		return m->is_static && m->vbo.layout == &mesh_vert_layout && m->vbo.storage == VBO_ARENA;
+	}
+	static bool same_render_state (Base_Mesh* l, Base_Mesh* r) {
+		if (l->texture_set == (u32)-1) l->texture_set = render_queue::get_texture_set(l->textures);
+		if (r->texture_set == (u32)-1) r->texture_set = render_queue::get_texture_set(r->textures);
+		return l->shad == r->shad && l->shad_transp_pass2 == r->shad_transp_pass2 && l->texture_set == r->texture_set;
+	}
+	
+	// call after the meshes were loaded and before they are uploaded
+	//  only opaque meshes, translucent ones have to stay sorted back to front individually
+	static void build () {
+		if (!enable) return;
+		
+		std::vector<Base_Mesh*> remaining;
+		for (auto* m : meshes_opaque) {
+			if (can_batch(m)) remaining.push_back(m);
+		}
+		
+		u32 batched = 0;
+		while (remaining.size() > 0) {
+			std::vector<Base_Mesh*> group;
+			std::vector<Base_Mesh*> rest;
+			for (auto* m : remaining) {
+				if (group.size() == 0 || same_render_state(group[0], m))	group.push_back(m);
+				else														rest.push_back(m);
+			}
+			remaining = std::move(rest);
+			
+			if (group.size() < 2) continue;
+			
+			auto* b = new Static_Batch(prints("static batch \"%s\" +%u", group[0]->name.c_str(), (u32)group.size() -1), group[0]);
+			for (auto* m : group) {
+				b->sources.push_back({ m });
+				m->batched_into = b;
+				
+				meshes_opaque.erase(std::find(meshes_opaque.begin(), meshes_opaque.end(), m));
+			}
+			
+			b->load();
+			b->calc_texel_density_info();
+			
+			meshes_opaque.push_back(b);
+			batches.push_back(b);
+			batched += (u32)group.size();
+		}
+		
+		if (batches.size() > 0) con_logf("merged %u static meshes into %u static batches", batched, (u32)batches.size());
+	}
+}
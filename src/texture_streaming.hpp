@@ -0,0 +1,167 @@
+
+// Mip level streaming of mesh textures under a vram budget
+//  all mips stay in cpu memory (we still load everything at startup), only the mips >= resident_mip of a texture are on the gpu
+//  each frame the drawn meshes request the mip their projected texel density needs, finer mips get uploaded (limited per frame)
+//  and while over the budget the finest mips of the least recently used textures are evicted
+namespace texture_streaming {
+	static bool		enable =					true;
+	static u64		vram_budget =				(u64)512 *1024*1024; // bytes for the mips of all streamed textures
+	static u64		upload_limit_per_frame =	(u64)16 *1024*1024; // so a lot of textures coming into view at once does not hitch
+	static u32		min_resident_res =			64; // mips of this resolution and lower are always resident
+	static f32		mip_bias =					0; // > 0 requests coarser mips
+	
+	static u64		resident_bytes =			0; // of the streamed textures, for display
+	
+	struct Streamed_Texture {
+		Texture2D*				tex;
+		std::vector<Base_Mesh*>	users;
+		
+		u32						wanted_mip;
+		u64						last_used_frame;
+	};
+	
+	static std::vector<Streamed_Texture>	streamed;
+	
+	static u32 get_min_mip (Texture2D* t) { // coarsest mip we start with, never evicted
+		u32 mip = 0;
+		while (mip +1 < (u32)t->mips.size() && max(t->mips[mip].dim.x, t->mips[mip].dim.y) > (s32)min_resident_res) ++mip;
+		return mip;
+	}
+	
+	// call after the textures were loaded (and packed) and before they are uploaded
+	static void init () {
+		if (!enable) return;
+		
+		for (auto* t : textures2d) {
+			if (!t->can_stream()) continue;
+			
+			Streamed_Texture st;
+			st.tex = t;
+			
+			for (auto* m : meshes) {
+				for (auto& at : m->textures) {
+					if (at.tex == t) {
+						st.users.push_back(m);
+						break;
+					}
+				}
+			}
+			if (st.users.size() == 0) continue; // only stream mesh textures, we have no way of knowing how others are used
+			
+			t->streamed = true;
+			t->resident_mip = get_min_mip(t); // start with only the coarse mips, so they upload fast
+			
+			st.wanted_mip = t->resident_mip;
+			st.last_used_frame = 0;
+			
+			streamed.push_back(st);
+		}
+	}
+	
+	static u32 calc_wanted_mip (Streamed_Texture const& st, u64 frame_i, hm world_to_cam, std::vector<ubo::Object> const& objects, f32 world_per_pixel_at_dist_1) {
+		auto* t = st.tex;
+		
+		f32 uv_per_pixel = +INF;
+		for (auto* m : st.users) {
+			if (m->last_drawn_frame != frame_i || m->uv_per_model_unit == 0) continue;
+			
+			m4 const& model_to_world = objects[m->ubo_slot].model_to_world;
+			f32 scale = max(length(model_to_world.arr[0].xyz()), max(length(model_to_world.arr[1].xyz()), length(model_to_world.arr[2].xyz())));
+			
+			// nearest point of the bounding sphere determines the finest mip needed
+			v3 center_cam = world_to_cam * (model_to_world * v4(m->bounds_center, 1)).xyz();
+			f32 dist = max(length(center_cam) -m->bounds_radius * scale, 1.0f/256);
+			
+			uv_per_pixel = min(uv_per_pixel, dist * world_per_pixel_at_dist_1 * m->uv_per_model_unit / scale);
+		}
+		
+		u32 min_mip = get_min_mip(t);
+		if (uv_per_pixel == +INF) return min_mip;
+		
+		f32 texels_per_pixel = uv_per_pixel * (f32)max(t->dim.x, t->dim.y);
+		f32 mip = floor(log2(max(texels_per_pixel, 1.0f/1024)) +mip_bias);
+		
+		return (u32)clamp((s32)mip, 0, (s32)min_mip);
+	}
+	
+	static Streamed_Texture* find_eviction_candidate (u64 frame_i) {
+		Streamed_Texture* best = nullptr;
+		for (auto& st : streamed) {
+			auto* t = st.tex;
+			if (!t->streamed || t->resident_mip >= get_min_mip(t)) continue; // nothing to evict
+			
+			bool more_than_wanted = t->resident_mip < st.wanted_mip;
+			if (st.last_used_frame == frame_i && !more_than_wanted) continue; // needed right now
+			
+			if (!best) {
+				best = &st;
+				continue;
+			}
+			
+			bool best_more_than_wanted = best->tex->resident_mip < best->wanted_mip;
+			if (more_than_wanted != best_more_than_wanted) {
+				if (more_than_wanted) best = &st; // mips nobody needs go first
+			} else if (st.last_used_frame < best->last_used_frame) {
+				best = &st; // least recently used
+			}
+		}
+		return best;
+	}
+	
+	static bool make_room (u64 size, u64 frame_i) {
+		while (resident_bytes +size > vram_budget) {
+			auto* st = find_eviction_candidate(frame_i);
+			if (!st) return false;
+			
+			auto* t = st->tex;
+			resident_bytes -= t->mips[t->resident_mip].size;
+			t->set_resident_mip(t->resident_mip +1);
+		}
+		return true;
+	}
+	
+	// call once per frame after drawing the meshes (they set their last_drawn_frame)
+	//  objects are the transforms the meshes were drawn with this frame, indexed by their ubo_slot
+	static void update (u64 frame_i, hm world_to_cam, f32 vfov, s32 screen_h, std::vector<ubo::Object> const& objects) {
+		if (streamed.size() == 0) return;
+		
+		f32 world_per_pixel_at_dist_1 = 2 * tan(vfov / 2) / (f32)screen_h;
+		
+		resident_bytes = 0;
+		for (auto& st : streamed) {
+			if (!st.tex->streamed) continue; // hot reloaded into something we cant stream
+			
+			st.wanted_mip = calc_wanted_mip(st, frame_i, world_to_cam, objects, world_per_pixel_at_dist_1);
+			for (auto* m : st.users) {
+				if (m->last_drawn_frame == frame_i) st.last_used_frame = frame_i;
+			}
+			
+			resident_bytes += st.tex->get_resident_size();
+		}
+		
+		make_room(0, frame_i); // in case the budget was lowered
+		
+		// stream in one mip per texture per frame, most undersampled textures first
+		std::vector<Streamed_Texture*> want_finer;
+		for (auto& st : streamed) {
+			if (st.tex->streamed && st.wanted_mip < st.tex->resident_mip) want_finer.push_back(&st);
+		}
+		std::sort(want_finer.begin(), want_finer.end(), [] (Streamed_Texture const* l, Streamed_Texture const* r) {
+			return (l->tex->resident_mip -l->wanted_mip) > (r->tex->resident_mip -r->wanted_mip);
+		});
+		
+		u64 uploaded = 0;
+		for (auto* st : want_finer) {
+			auto* t = st->tex;
+			u64 size = t->mips[t->resident_mip -1].size;
+			
+			if (uploaded > 0 && uploaded +size > upload_limit_per_frame) break;
+			if (!make_room(size, frame_i)) break;
+			
+			t->set_resident_mip(t->resident_mip -1);
+			
+			resident_bytes += size;
+			uploaded += size;
+		}
+	}
+}